@@ -0,0 +1,420 @@
+//
+// Configuration
+//
+
+// Header
+#include "archive.hpp"
+
+// Standard library
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// Platform
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define ARCHIVE_MAGIC "OLAR"
+#define ARCHIVE_INDEX_MAGIC "OLAI"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 64
+#define ARCHIVE_INDEX_INTERVAL 256  // rows per sparse index entry
+
+
+//
+// Auxiliary
+//
+
+static void put(std::vector<byte> &buffer, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buffer.push_back((byte)(value >> (8 * i)));
+}
+
+static uint64_t get(const byte *buffer, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= (uint64_t)buffer[i] << (8 * i);
+    return value;
+}
+
+static void write_all(int fd, const std::vector<byte> &buffer)
+{
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t length = write(fd, buffer.data() + written, buffer.size() - written);
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length < 0)
+            throw std::runtime_error("Unable to write to archive: " + std::string(strerror(errno)));
+        written += length;
+    }
+}
+
+// Holds an exclusive lock on the archive, so concurrent writers append
+// whole rows one after another
+class ArchiveLock
+{
+public:
+    ArchiveLock(int fd) : _fd(fd) { flock(_fd, LOCK_EX); }
+    ~ArchiveLock() { flock(_fd, LOCK_UN); }
+
+private:
+    int _fd;
+};
+
+
+//
+// Construction and destruction
+//
+
+/**
+ * Open an archive, creating it if it does not exist yet.
+ * @param filename         File holding the archive.
+ * @param external_sensors Amount of external sensors of the station, which
+ *                         an existing archive has to match.
+ */
+Archive::Archive(const std::string &filename, unsigned int external_sensors)
+    : _filename(filename), _fd(-1), _map(0), _map_size(0),
+      _external_sensors(external_sensors), _header_size(ARCHIVE_HEADER_SIZE),
+      _row_size(8 + 3 * (external_sensors + 1)), _rows(0)
+{
+    if (external_sensors > 3)
+        throw std::invalid_argument("Unsupported amount of external sensors");
+
+    _fd = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+        throw std::runtime_error("Unable to open archive: " + std::string(strerror(errno)));
+
+    try {
+        ArchiveLock lock(_fd);
+        struct stat status;
+        if (fstat(_fd, &status) < 0)
+            throw std::runtime_error("Unable to inspect archive");
+
+        if (status.st_size == 0) {
+            std::vector<byte> header(ARCHIVE_MAGIC, ARCHIVE_MAGIC + 4);
+            put(header, ARCHIVE_VERSION, 4);
+            put(header, _external_sensors, 4);
+            put(header, _row_size, 4);
+            header.resize(ARCHIVE_HEADER_SIZE, 0);
+            write_all(_fd, header);
+        } else {
+            byte header[ARCHIVE_HEADER_SIZE];
+            if (status.st_size < ARCHIVE_HEADER_SIZE
+                || pread(_fd, header, sizeof(header), 0) != sizeof(header)
+                || memcmp(header, ARCHIVE_MAGIC, 4) != 0)
+                throw std::runtime_error("Invalid archive");
+            if (get(header + 4, 4) != ARCHIVE_VERSION)
+                throw std::runtime_error("Unsupported archive version");
+            if (get(header + 8, 4) != _external_sensors || get(header + 12, 4) != _row_size)
+                throw std::runtime_error("Archive holds a different amount of sensors");
+
+            // Drop a row which was only partially appended
+            size_t rows = (status.st_size - ARCHIVE_HEADER_SIZE) / _row_size;
+            if (ARCHIVE_HEADER_SIZE + rows * _row_size != (size_t)status.st_size) {
+                clog(warning) << "Truncating incomplete row of archive " << filename << std::endl;
+                if (ftruncate(_fd, ARCHIVE_HEADER_SIZE + rows * _row_size) < 0)
+                    throw std::runtime_error("Unable to truncate archive");
+            }
+        }
+
+        map();
+    }
+    catch (...) {
+        unmap();
+        close(_fd);
+        throw;
+    }
+
+    // Load the sparse index, which is only trusted if it agrees with the rows
+    std::ifstream file((_filename + ".idx").c_str(), std::ios::binary);
+    std::vector<byte> buffer((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    if (buffer.size() >= 12 && memcmp(buffer.data(), ARCHIVE_INDEX_MAGIC, 4) == 0
+        && get(&buffer[4], 4) == ARCHIVE_VERSION
+        && get(&buffer[8], 4) == ARCHIVE_INDEX_INTERVAL) {
+        for (size_t offset = 12; offset + 8 <= buffer.size(); offset += 8)
+            _index.push_back((time_t)get(&buffer[offset], 8));
+    }
+    size_t covered = _index.size() * ARCHIVE_INDEX_INTERVAL;
+    if (!_index.empty() && (covered - ARCHIVE_INDEX_INTERVAL >= _rows
+        || _index.back() != datetime(covered - ARCHIVE_INDEX_INTERVAL))) {
+        clog(warning) << "Rebuilding index of archive " << filename << std::endl;
+        _index.clear();
+    }
+
+    size_t entries = _index.size();
+    extend_index();
+    if (_index.size() != entries) {
+        try {
+            save_index();
+        }
+        catch (std::exception const &e) {
+            clog(warning) << e.what() << std::endl;
+        }
+    }
+}
+
+Archive::~Archive()
+{
+    unmap();
+    close(_fd);
+}
+
+
+//
+// Properties
+//
+
+time_t Archive::first() const
+{
+    return _rows ? datetime(0) : -1;
+}
+
+time_t Archive::last() const
+{
+    return _rows ? datetime(_rows - 1) : -1;
+}
+
+/**
+ * Get the time of the last row of an archive without opening it, which does
+ * not require knowing the amount of sensors it holds.
+ * @param filename File holding the archive.
+ * @return         Time of the last row, or -1 if there is no such archive or
+ *                 it is empty.
+ */
+time_t Archive::latest(const std::string &filename)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    byte header[ARCHIVE_HEADER_SIZE];
+    if (!file.read((char *)header, sizeof(header)))
+        return -1;
+    if (memcmp(header, ARCHIVE_MAGIC, 4) != 0 || get(header + 4, 4) != ARCHIVE_VERSION)
+        throw std::runtime_error("Invalid archive");
+    size_t external_sensors = (size_t)get(header + 8, 4);
+    size_t row_size = (size_t)get(header + 12, 4);
+    if (external_sensors > 3 || row_size != 8 + 3 * (external_sensors + 1))
+        throw std::runtime_error("Invalid archive");
+
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    if (size < (std::streamoff)(ARCHIVE_HEADER_SIZE + row_size))
+        return -1;
+    size_t rows = ((size_t)size - ARCHIVE_HEADER_SIZE) / row_size;
+
+    byte timestamp[8];
+    file.seekg(ARCHIVE_HEADER_SIZE + (rows - 1) * row_size);
+    if (!file.read((char *)timestamp, sizeof(timestamp)))
+        throw std::runtime_error("Unable to read archive");
+    return (time_t)(int64_t)get(timestamp, 8);
+}
+
+
+//
+// Appending
+//
+
+/**
+ * Append the records of a batch which are more recent than the last one in
+ * the archive, skipping the history delimiter.
+ * @param batch Records to append, in chronological order.
+ * @return      Amount of records appended.
+ */
+size_t Archive::append(const Station::HistoryBatch &batch)
+{
+    if (batch.external_sensors() != _external_sensors)
+        throw std::invalid_argument("Batch holds a different amount of sensors");
+
+    size_t appended = 0;
+    {
+        // Another writer might have appended since the archive was mapped
+        ArchiveLock lock(_fd);
+        map();
+
+        time_t last = this->last();
+        std::vector<byte> buffer;
+        for (size_t i = 0; i < batch.size(); i++) {
+            time_t datetime = batch.datetime(i);
+            if (datetime == -1 || datetime <= last)
+                continue;
+            put(buffer, (uint64_t)(int64_t)datetime, 8);
+            for (unsigned int s = 0; s <= _external_sensors; s++) {
+                put(buffer, (uint16_t)batch.temperatures(s)[i], 2);
+                put(buffer, batch.humidities(s)[i], 1);
+            }
+            last = datetime;
+            appended++;
+        }
+        if (appended == 0)
+            return 0;
+
+        write_all(_fd, buffer);
+        fdatasync(_fd);
+        map();
+    }
+
+    extend_index();
+    save_index();
+    return appended;
+}
+
+
+//
+// Row access
+//
+
+time_t Archive::datetime(size_t index) const
+{
+    return (time_t)(int64_t)get(row(index), 8);
+}
+
+boost::optional<double> Archive::temperature(size_t index, unsigned int sensor) const
+{
+    int16_t value = (int16_t)get(row(index) + 8 + 3 * sensor, 2);
+    if (value == TEMPERATURE_UNAVAILABLE)
+        return boost::none;
+    return value / 10.0;
+}
+
+boost::optional<unsigned int> Archive::humidity(size_t index, unsigned int sensor) const
+{
+    uint8_t value = row(index)[8 + 3 * sensor + 2];
+    if (value == HUMIDITY_UNAVAILABLE)
+        return boost::none;
+    return (unsigned int)value;
+}
+
+/**
+ * Copy a range of rows into a history batch.
+ * @param begin Index of the first row.
+ * @param end   Index past the last row.
+ * @return      Records.
+ */
+Station::HistoryBatch Archive::rows(size_t begin, size_t end) const
+{
+    end = std::min(end, _rows);
+    begin = std::min(begin, end);
+
+    Station::HistoryBatch batch(_external_sensors, end - begin);
+    for (size_t i = 0; i < batch.size(); i++) {
+        const byte *data = row(begin + i);
+        batch.datetimes()[i] = (time_t)(int64_t)get(data, 8);
+        for (unsigned int s = 0; s <= _external_sensors; s++) {
+            batch.temperatures(s)[i] = (int16_t)get(data + 8 + 3 * s, 2);
+            batch.humidities(s)[i] = data[8 + 3 * s + 2];
+        }
+    }
+    return batch;
+}
+
+
+//
+// Seeking
+//
+
+/**
+ * Find the first row at or after a point in time, using the sparse index to
+ * narrow the search down to a single interval of rows.
+ * @param datetime Point in time.
+ * @return         Index of the row, or the amount of rows if there is none.
+ */
+size_t Archive::seek(time_t datetime) const
+{
+    size_t entry = std::lower_bound(_index.begin(), _index.end(), datetime) - _index.begin();
+    if (entry == 0)
+        return 0;
+
+    size_t low = (entry - 1) * ARCHIVE_INDEX_INTERVAL;
+    size_t high = std::min(entry * ARCHIVE_INDEX_INTERVAL, _rows);
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (this->datetime(middle) < datetime)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Find the rows within a period of time.
+ * @param from Start of the period.
+ * @param to   End of the period, inclusive.
+ * @return     Index of the first row, and index past the last row.
+ */
+std::pair<size_t, size_t> Archive::range(time_t from, time_t to) const
+{
+    size_t begin = seek(from);
+    size_t end = (to == (time_t)-1) ? _rows : seek(to + 1);
+    return std::make_pair(begin, std::max(begin, end));
+}
+
+
+//
+// Auxiliary
+//
+
+// (Re)map the entire archive, picking up rows appended in the meantime
+void Archive::map()
+{
+    struct stat status;
+    if (fstat(_fd, &status) < 0)
+        throw std::runtime_error("Unable to inspect archive");
+    size_t size = status.st_size;
+    if (_map && size == _map_size)
+        return;
+
+    unmap();
+    void *map = mmap(0, size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+        throw std::runtime_error("Unable to map archive: " + std::string(strerror(errno)));
+    _map = (const byte *)map;
+    _map_size = size;
+    _rows = (size - _header_size) / _row_size;
+}
+
+void Archive::unmap()
+{
+    if (_map)
+        munmap((void *)_map, _map_size);
+    _map = 0;
+    _map_size = 0;
+}
+
+void Archive::extend_index()
+{
+    for (size_t row = _index.size() * ARCHIVE_INDEX_INTERVAL; row < _rows;
+        row += ARCHIVE_INDEX_INTERVAL)
+        _index.push_back(datetime(row));
+}
+
+// The index can always be rebuilt from the rows, so it is simply replaced
+void Archive::save_index() const
+{
+    std::vector<byte> buffer(ARCHIVE_INDEX_MAGIC, ARCHIVE_INDEX_MAGIC + 4);
+    put(buffer, ARCHIVE_VERSION, 4);
+    put(buffer, ARCHIVE_INDEX_INTERVAL, 4);
+    for (size_t i = 0; i < _index.size(); i++)
+        put(buffer, (uint64_t)(int64_t)_index[i], 8);
+
+    const std::string filename = _filename + ".idx";
+    const std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary.c_str(), std::ios::binary);
+    file.write((const char *)buffer.data(), buffer.size());
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) < 0)
+        throw std::runtime_error("Unable to save archive index");
+}
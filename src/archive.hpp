@@ -0,0 +1,86 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_ARCHIVE_
+#define _OPENLACROSSE_ARCHIVE_
+
+// Standard library
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <ctime>
+
+// Boost
+#include <boost/optional.hpp>
+
+// Local includes
+#include "global.hpp"
+#include "station.hpp"
+
+
+//
+// Module definitions
+//
+
+// Append-only file of decoded history records. After a fixed header, every
+// record is stored as a fixed-size row: a little-endian 64-bit timestamp,
+// followed per sensor by a 16-bit temperature in tenths of degrees and an
+// 8-bit humidity, using the sentinels of history batches. Rows are kept in
+// chronological order, and every ARCHIVE_INDEX_INTERVAL'th timestamp is
+// kept in a sparse index next to the archive, so seeking by time only
+// touches a few pages of the memory-mapped rows.
+class Archive
+{
+public:
+    // Construction and destruction
+    Archive(const std::string &filename, unsigned int external_sensors);
+    ~Archive();
+
+    // Properties
+    size_t size() const { return _rows; }
+    unsigned int external_sensors() const { return _external_sensors; }
+    time_t first() const;
+    time_t last() const;
+    static time_t latest(const std::string &filename);
+
+    // Appending
+    size_t append(const Station::HistoryBatch &batch);
+
+    // Row access
+    const byte *row(size_t index) const { return _map + _header_size + index * _row_size; }
+    time_t datetime(size_t index) const;
+    boost::optional<double> temperature(size_t index, unsigned int sensor) const;
+    boost::optional<unsigned int> humidity(size_t index, unsigned int sensor) const;
+    Station::HistoryBatch rows(size_t begin, size_t end) const;
+
+    // Seeking
+    size_t seek(time_t datetime) const;
+    std::pair<size_t, size_t> range(time_t from, time_t to) const;
+
+private:
+    // Auxiliary
+    void map();
+    void unmap();
+    void extend_index();
+    void save_index() const;
+
+    // File
+    std::string _filename;
+    int _fd;
+    const byte *_map;
+    size_t _map_size;
+
+    // Layout
+    unsigned int _external_sensors;
+    size_t _header_size;
+    size_t _row_size;
+    size_t _rows;
+
+    // Timestamps of every ARCHIVE_INDEX_INTERVAL'th row
+    std::vector<time_t> _index;
+};
+
+#endif
@@ -0,0 +1,199 @@
+//
+// Configuration
+//
+
+// Header
+#include "asyncserialinterface.hpp"
+
+// Standard library
+#include <algorithm>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define WAIT_POLL_INTERVAL 10   // ms between polls of DSR
+#define MAGIC_LENGTH 64         // characters of the magic string, like the
+                                // blocking WS8610 handshake sends
+
+
+//
+// Construction and destruction
+//
+
+AsyncSerialInterface::AsyncSerialInterface(SerialInterface &iface, EventLoop &loop)
+    : _iface(iface), _loop(loop)
+{
+}
+
+
+//
+// Handshake
+//
+
+/**
+ * Wait for the Data Set Ready line to reach a status. Waiting for line
+ * changes would block the loop, so the line is polled instead.
+ * @param value      Status to wait for.
+ * @param timeout_ms Maximal time to wait.
+ * @return           Whether the line reached the status in time.
+ */
+Task<bool> AsyncSerialInterface::wait_DSR(bool value, unsigned int timeout_ms)
+{
+    uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ULL;
+    for (;;) {
+        _iface.statistics().handshake_waits++;
+        if (_iface.get_DSR() == value)
+            co_return true;
+
+        uint64_t now = monotonic_ns();
+        if (now >= deadline)
+            co_return false;
+        co_await _loop.sleep_until(std::min<uint64_t>(deadline, now + WAIT_POLL_INTERVAL * 1000000ULL));
+    }
+}
+
+
+/**
+ * Open a session with the station, like the blocking WS8610 handshake does:
+ * send the magic string, wait for the station to pulse DSR while the host
+ * lines are cleared, and send the magic string again.
+ * @param timeout_ms Maximal time to wait for each DSR edge.
+ * @return           Whether the station answered in time.
+ */
+Task<bool> AsyncSerialInterface::handshake(unsigned int timeout_ms)
+{
+    std::vector<byte> magic(MAGIC_LENGTH, 'U');
+    _iface.write_device(magic);
+    _iface.set_DTR(false);
+    _iface.set_RTS(false);
+
+    uint64_t start = monotonic_ns();
+    if (!co_await wait_DSR(true, timeout_ms))
+        co_return false;
+    uint64_t raised = monotonic_ns();
+    if (!co_await wait_DSR(false, timeout_ms))
+        co_return false;
+    uint64_t cleared = monotonic_ns();
+    _iface.set_RTS(true);
+    _iface.set_DTR(true);
+
+    _iface.write_device(magic);
+
+    Statistics &stats = _iface.statistics();
+    stats.handshake_raise_ns += raised - start;
+    stats.handshake_clear_ns += cleared - raised;
+    stats.handshakes++;
+    co_return true;
+}
+
+
+//
+// Generic I/O operations
+//
+
+/**
+ * Read an arbitrary amount of data.
+ * @param location Location to read from.
+ * @param length   Amount of bytes to read.
+ * @return         Data read, or nothing if the station did not acknowledge
+ *                 the request.
+ */
+Task<std::vector<byte>> AsyncSerialInterface::read_data(address location, size_t length)
+{
+    Waveform addressing;
+    SerialInterface::compile_request(addressing, location);
+    SerialInterface::compile_command(addressing, 0xA1, true);
+    if (!co_await run(addressing))
+        co_return std::vector<byte>();
+
+    std::vector<byte> data(length);
+    for (size_t i = 0; i < length; i++)
+        co_await run(i == 0 ? _iface._read_first : _iface._read_next, &data[i]);
+    co_await run(_iface._end);
+
+    co_return data;
+}
+
+
+/**
+ * Write an arbitrary amount of data.
+ * @param location Location to write to.
+ * @param data     Data to write.
+ * @return         Whether the station acknowledged the data and reported
+ *                 the write as successful.
+ */
+Task<bool> AsyncSerialInterface::write_data(address location, const std::vector<byte> &data)
+{
+    Waveform waveform;
+    SerialInterface::compile_write_data(waveform, location, data);
+
+    byte status;
+    if (!co_await run(waveform, &status))
+        co_return false;
+    co_return status == 0;
+}
+
+
+//
+// Command interface
+//
+
+Task<void> AsyncSerialInterface::start_sequence()
+{
+    Waveform waveform;
+    SerialInterface::compile_start_sequence(waveform);
+    co_await run(waveform);
+}
+
+Task<void> AsyncSerialInterface::end_command()
+{
+    co_await run(_iface._end);
+}
+
+
+//
+// Waveform execution
+//
+
+/**
+ * Execute a precompiled waveform, suspending during the delays.
+ * @param waveform Waveform to execute, which has to outlive the task.
+ * @param sampled  Optional output for the bits sampled from CTS, MSB first.
+ * @return         Whether all acknowledgements were received.
+ */
+Task<bool> AsyncSerialInterface::run(const Waveform &waveform, byte *sampled)
+{
+    byte value = 0;
+    _iface.statistics().bits_written += waveform.bits_written();
+    _iface._bit_mark = monotonic_ns();
+    const std::vector<Waveform::Step> &steps = waveform.steps();
+    for (auto step = steps.begin(); step != steps.end(); ++step) {
+        if (step->opcode == Waveform::DELAY)
+            co_await delay();
+        else if (!_iface.execute(*step, value))
+            co_return false;
+    }
+
+    if (sampled)
+        *sampled = value;
+    co_return true;
+}
+
+
+//
+// Auxiliary
+//
+
+Task<void> AsyncSerialInterface::delay()
+{
+    uint64_t start = monotonic_ns();
+    co_await _loop.sleep_until(start + _iface.edge_delay());
+    uint64_t achieved = monotonic_ns() - start;
+
+    Statistics &stats = _iface.statistics();
+    stats.delays++;
+    stats.delay_ns += achieved;
+    stats.delay_requested_ns += _iface.edge_delay();
+    stats.delay_max_ns = std::max(stats.delay_max_ns, achieved);
+}
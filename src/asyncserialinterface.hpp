@@ -0,0 +1,63 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_ASYNCSERIALINTERFACE_
+#define _OPENLACROSSE_ASYNCSERIALINTERFACE_
+
+// Standard library
+#include <vector>
+
+// Local includes
+#include "global.hpp"
+#include "eventloop.hpp"
+#include "serialinterface.hpp"
+#include "task.hpp"
+#include "waveform.hpp"
+
+
+//
+// Module definitions
+//
+
+// Coroutine interface to the bus transactions of a serial interface. The same
+// precompiled waveforms are executed, but instead of sleeping the line
+// settling delays suspend the transaction on the event loop, so other
+// transactions and I/O can proceed in the meantime. The blocking operations
+// of the serial interface remain available, and share its state and
+// statistics.
+class AsyncSerialInterface
+{
+public:
+    // Construction and destruction
+    AsyncSerialInterface(SerialInterface &iface, EventLoop &loop);
+
+    // Properties
+    SerialInterface &blocking() { return _iface; }
+    EventLoop &loop() { return _loop; }
+
+    // Handshake
+    Task<bool> wait_DSR(bool value, unsigned int timeout_ms);
+    Task<bool> handshake(unsigned int timeout_ms);
+
+    // Generic I/O operations
+    Task<std::vector<byte>> read_data(address location, size_t length);
+    Task<bool> write_data(address location, const std::vector<byte> &data);
+
+    // Command interface
+    Task<void> start_sequence();
+    Task<void> end_command();
+
+    // Waveform execution
+    Task<bool> run(const Waveform &waveform, byte *sampled = 0);
+
+private:
+    // Auxiliary
+    Task<void> delay();
+
+    SerialInterface &_iface;
+    EventLoop &_loop;
+};
+
+#endif
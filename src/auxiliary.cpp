@@ -8,7 +8,9 @@
 
 // Standard library
 #include <sstream>
+#include <iomanip>
 #include <ctime>
+#include <cassert>
 
 // Null stream
 std::ostream cnull(0);
@@ -17,6 +19,48 @@ std::ostream cnull(0);
 Logger logger;
 
 
+//
+// Streambuffer
+//
+
+// Line being written by the current thread, and the last character it wrote
+static thread_local std::string pending_line;
+static thread_local char last_written = '\n';
+
+char keepbuf::last_char() const
+{
+    return last_written;
+}
+
+keepbuf::int_type keepbuf::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    pending_line += traits_type::to_char_type(c);
+    last_written = traits_type::to_char_type(c);
+    if (last_written == '\n')
+        flush_line();
+    return c;
+}
+
+int keepbuf::sync()
+{
+    flush_line();
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _buf->pubsync();
+}
+
+void keepbuf::flush_line()
+{
+    if (pending_line.empty())
+        return;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buf->sputn(pending_line.data(), pending_line.size());
+    pending_line.clear();
+}
+
+
 //
 // Construction and destruction
 //
@@ -41,16 +85,19 @@ Logger::Logger() : _buf(std::cout.rdbuf()) {
 std::ostream& Logger::log(LogLevel level)
 {
     if (level <= settings.threshold) {
+        // Every thread formats into a stream of its own, sharing the buffer
+        static thread_local std::ostream stream(&_buf);
+
         // Manage prefixes
         char last_char = _buf.last_char();
         if (last_char == '\r' || last_char == '\n') {
             if (settings.prefix_timestamp)
-                std::cout << timestamp() << "  ";
+                stream << timestamp() << "  ";
             if (settings.prefix_level)
-                std::cout << prefix(level) << "\t";
+                stream << prefix(level) << "\t";
         }
 
-        return std::cout;
+        return stream;
     } else {
         return cnull;
     }
@@ -65,11 +112,13 @@ std::string Logger::timestamp()
 {
 	time_t datetime;
 	time(&datetime);
+	struct tm timeinfo;
+	localtime_r(&datetime, &timeinfo);
 
 	std::string buffer;
 	buffer.resize(32);
 
-	size_t len = strftime(&buffer[0], buffer.length(), "%Y-%m-%dT%H:%M:%S%z", localtime(&datetime));
+	size_t len = strftime(&buffer[0], buffer.length(), "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
 	assert(len);
 	buffer.resize(len);
 
@@ -174,3 +223,10 @@ std::string hexdump(void* x, unsigned long len, unsigned int w)
   return osDump.str();
 }
 
+// Current time of the monotonic clock, in nanoseconds
+uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -8,6 +8,9 @@
 
 // Standard library
 #include <iostream>
+#include <cstdint>
+#include <mutex>
+#include <string>
 
 // Boost
 #include <boost/integer.hpp>
@@ -27,24 +30,24 @@ enum LogLevel {
     trace
 };
 
-// Streambuffer
+// Streambuffer, which hands complete lines to the underlying buffer at once
+// so lines logged from several threads never interleave. What a thread
+// wrote last is kept per thread.
 class keepbuf : public std::streambuf {
 public:
-    keepbuf(std::streambuf* buf) : _buf(buf), _last_char('\n') {
-        // traits_type::eof would be better, but this fits our use case
+    keepbuf(std::streambuf* buf) : _buf(buf) {
         // no buffering, overflow on every char
         setp(0, 0);
     }
-    char last_char() const { return _last_char; }
+    char last_char() const;
 
-    virtual int_type overflow(int_type c) {
-        _buf->sputc(c);
-        _last_char = c;
-        return c;
-    }
+    virtual int_type overflow(int_type c);
+    virtual int sync();
 private:
+    void flush_line();
+
     std::streambuf* _buf;
-    char _last_char;
+    std::mutex _mutex;
 };
 
 // Null stream
@@ -81,5 +84,6 @@ std::ostream& clog(LogLevel level);
 
 // Auxiliary functions
 std::string hexdump(void* x, unsigned long len, unsigned int w=16);
+uint64_t monotonic_ns();
 
 #endif
@@ -0,0 +1,533 @@
+//
+// Configuration
+//
+
+// Standard library
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <ctime>
+
+// Boost
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+// Local includes
+#include "archive.hpp"
+#include "auxiliary.hpp"
+#include "compressedarchive.hpp"
+#include "formatting.hpp"
+#include "serialinterface.hpp"
+#include "ws8610.hpp"
+#include "ws8610decoder.hpp"
+#include "ws8610emulator.hpp"
+#ifdef HAVE_ASYNC
+#include "asyncserialinterface.hpp"
+#include "eventloop.hpp"
+#endif
+
+// Configurable values
+#define BENCH_SENSORS 3
+#define BENCH_RECORDS 1000
+#define BENCH_TIMESTAMP 1356998400  // 2013-01-01 00:00:00 UTC
+#define BENCH_ARCHIVE "lacrosse-bench.archive"
+#define BENCH_HANDSHAKE_TIMEOUT 1000    // ms to wait for each DSR edge
+#define BENCH_WRITE_LOCATION 0x0020     // byte overwritten to check writes
+
+
+//
+// Auxiliary
+//
+
+// Line driver which counts the primitive operations, each of which would be
+// an ioctl on real hardware
+class CountingDriver : public LineDriver
+{
+public:
+    CountingDriver(LineDriver *driver) : calls(0), _driver(driver) { }
+
+    void set_lines(int lines) { calls++; _driver->set_lines(lines); }
+    int get_lines() { calls++; return _driver->get_lines(); }
+    std::vector<byte> read_device(size_t length) { return _driver->read_device(length); }
+    void write_device(const std::vector<byte> &data) { _driver->write_device(data); }
+
+    unsigned long calls;
+
+private:
+    std::unique_ptr<LineDriver> _driver;
+};
+
+class Stopwatch
+{
+public:
+    Stopwatch() { clock_gettime(CLOCK_MONOTONIC, &_start); }
+    double seconds() const
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - _start.tv_sec) + (now.tv_nsec - _start.tv_nsec) / 1e9;
+    }
+
+private:
+    struct timespec _start;
+};
+
+struct Result
+{
+    std::string name;
+    unsigned long iterations;
+    double seconds;
+    std::map<std::string, double> metrics;
+};
+
+static std::string json(const std::vector<Result> &results)
+{
+    std::ostringstream os;
+    os.precision(9);
+    os << "{\n  \"timestamp\": " << time(0) << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        os << (i ? "," : "") << "\n    {\"name\": \"" << result.name << "\""
+           << ", \"iterations\": " << result.iterations
+           << ", \"seconds\": " << result.seconds
+           << ", \"ns_per_op\": " << result.seconds * 1e9 / result.iterations;
+        for (auto metric = result.metrics.begin(); metric != result.metrics.end(); ++metric)
+            os << ", \"" << metric->first << "\": " << metric->second;
+        os << "}";
+    }
+    os << "\n  ]\n}\n";
+    return os.str();
+}
+
+// Extract the history records from a memory image
+static std::vector<std::vector<byte>> records(const std::vector<byte> &memory,
+    unsigned int record_size, unsigned int count)
+{
+    std::vector<std::vector<byte>> records;
+    for (unsigned int i = 0; i < count; i++) {
+        auto start = memory.begin() + 0x64 + i * record_size;
+        records.push_back(std::vector<byte>(start, start + record_size));
+    }
+    return records;
+}
+
+
+//
+// Benchmarks
+//
+
+static Result bench_read_data(const std::vector<byte> &memory, size_t length,
+    unsigned long iterations)
+{
+    CountingDriver *driver = new CountingDriver(new WS8610Emulator(memory));
+    SerialInterface iface(driver);
+
+    unsigned long checksum = 0;
+    unsigned long calls = driver->calls;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++) {
+        iface.start_sequence();
+        auto data = iface.read_data((address)(0x64 + i * length % 0x7000), length);
+        checksum += data.size();
+    }
+    double seconds = watch.seconds();
+    calls = driver->calls - calls;
+
+    std::ostringstream name;
+    name << "serial/read_data/" << length;
+    Result result = {name.str(), iterations, seconds, std::map<std::string, double>()};
+    result.metrics["bytes_per_second"] = checksum / seconds;
+    result.metrics["ioctls_per_byte"] = (double)calls / checksum;
+    return result;
+}
+
+#ifdef HAVE_ASYNC
+// Open a session and read a range in chunks, followed by a write which is read
+// back, all through the coroutine interface
+static Task<void> async_station(AsyncSerialInterface &iface, size_t length,
+    unsigned long chunks, std::vector<byte> &output, bool &failed)
+{
+    if (!co_await iface.handshake(BENCH_HANDSHAKE_TIMEOUT)) {
+        failed = true;
+        co_return;
+    }
+
+    for (unsigned long i = 0; i < chunks; i++) {
+        co_await iface.start_sequence();
+        std::vector<byte> data = co_await iface.read_data((address)(0x64 + i * length), length);
+        output.insert(output.end(), data.begin(), data.end());
+    }
+
+    co_await iface.start_sequence();
+    if (!co_await iface.write_data(BENCH_WRITE_LOCATION, std::vector<byte>(1, 0x5A))) {
+        failed = true;
+        co_return;
+    }
+    co_await iface.start_sequence();
+    std::vector<byte> data = co_await iface.read_data(BENCH_WRITE_LOCATION, 1);
+    output.insert(output.end(), data.begin(), data.end());
+}
+
+static Result bench_async_interleaved(const std::vector<byte> &memory, unsigned int stations,
+    size_t length, unsigned long iterations)
+{
+    // Run all stations concurrently on a single loop
+    EventLoop loop;
+    std::vector<std::unique_ptr<SerialInterface>> ifaces;
+    std::vector<std::unique_ptr<AsyncSerialInterface>> asyncs;
+    std::vector<std::vector<byte>> outputs(stations);
+    bool failed = false;
+    for (unsigned int station = 0; station < stations; station++) {
+        ifaces.emplace_back(new SerialInterface(new WS8610Emulator(memory)));
+        asyncs.emplace_back(new AsyncSerialInterface(*ifaces.back(), loop));
+        loop.spawn(async_station(*asyncs.back(), length, iterations, outputs[station], failed));
+    }
+    Stopwatch watch;
+    loop.run();
+    double seconds = watch.seconds();
+
+    // Verify against the blocking interface, on a station of its own
+    SerialInterface reference(new WS8610Emulator(memory));
+    std::vector<byte> expected;
+    for (unsigned long i = 0; i < iterations; i++) {
+        reference.start_sequence();
+        std::vector<byte> data = reference.read_data((address)(0x64 + i * length), length);
+        expected.insert(expected.end(), data.begin(), data.end());
+    }
+    reference.start_sequence();
+    if (!reference.write_data(BENCH_WRITE_LOCATION, std::vector<byte>(1, 0x5A)))
+        failed = true;
+    reference.start_sequence();
+    std::vector<byte> data = reference.read_data(BENCH_WRITE_LOCATION, 1);
+    expected.insert(expected.end(), data.begin(), data.end());
+
+    unsigned long mismatches = failed ? 1 : 0;
+    for (unsigned int station = 0; station < stations; station++)
+        if (outputs[station] != expected)
+            mismatches++;
+    if (mismatches)
+        clog(error) << "Asynchronous transfers differ from blocking ones" << std::endl;
+
+    std::ostringstream name;
+    name << "async/interleaved/" << stations;
+    Result result = {name.str(), iterations * stations, seconds, std::map<std::string, double>()};
+    result.metrics["bytes_per_second"] = stations * iterations * length / seconds;
+    result.metrics["mismatches"] = (double)mismatches;
+    return result;
+}
+#endif
+
+static Result bench_history(const std::vector<byte> &memory, Validation::Mode validation,
+    unsigned long iterations)
+{
+    CountingDriver *driver = new CountingDriver(new WS8610Emulator(memory));
+    WS8610 station(driver);
+    station.set_validation(validation);
+
+    unsigned long checksum = 0;
+    unsigned long calls = driver->calls;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++)
+        checksum += station.history((unsigned int)i).external.size();
+    double seconds = watch.seconds();
+    calls = driver->calls - calls;
+
+    std::string name = (validation == Validation::SEMANTIC) ? "ws8610/history_semantic" : "ws8610/history";
+    Result result = {name, iterations, seconds, std::map<std::string, double>()};
+    result.metrics["ioctls_per_record"] = (double)calls / iterations;
+    result.metrics["sensors"] = (double)checksum / iterations;
+    return result;
+}
+
+static Result bench_parse_datetime(const std::vector<std::vector<byte>> &records,
+    unsigned long iterations)
+{
+    time_t checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++)
+        checksum += WS8610::parse_datetime(records[i % records.size()]);
+    double seconds = watch.seconds();
+
+    Result result = {"decode/parse_datetime", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations / seconds;
+    result.metrics["checksum"] = (double)(checksum % 86400);
+    return result;
+}
+
+static Result bench_parse_temperature(const std::vector<std::vector<byte>> &records,
+    unsigned long iterations)
+{
+    double checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++) {
+        const std::vector<byte> &record = records[i % records.size()];
+        for (int s = 0; s <= BENCH_SENSORS; s++) {
+            auto temperature = WS8610::parse_temperature(record, s);
+            if (temperature)
+                checksum += *temperature;
+        }
+    }
+    double seconds = watch.seconds();
+
+    Result result = {"decode/parse_temperature", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations / seconds;
+    result.metrics["checksum"] = checksum;
+    return result;
+}
+
+static Result bench_parse_humidity(const std::vector<std::vector<byte>> &records,
+    unsigned long iterations)
+{
+    unsigned long checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++) {
+        const std::vector<byte> &record = records[i % records.size()];
+        for (int s = 0; s <= BENCH_SENSORS; s++) {
+            auto humidity = WS8610::parse_humidity(record, s);
+            if (humidity)
+                checksum += *humidity;
+        }
+    }
+    double seconds = watch.seconds();
+
+    Result result = {"decode/parse_humidity", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations / seconds;
+    result.metrics["checksum"] = (double)checksum;
+    return result;
+}
+
+static Result bench_decode_records(const std::vector<byte> &memory, unsigned long iterations)
+{
+    const size_t count = (0x7FFF - 0x64) / 15;
+    std::vector<time_t> datetime(count);
+    std::vector<int16_t> temperature[BENCH_SENSORS + 1];
+    std::vector<uint8_t> humidity[BENCH_SENSORS + 1];
+    RecordColumns columns = {datetime.data(), {0, 0, 0, 0}, {0, 0, 0, 0}};
+    for (int s = 0; s <= BENCH_SENSORS; s++) {
+        temperature[s].resize(count);
+        humidity[s].resize(count);
+        columns.temperature[s] = temperature[s].data();
+        columns.humidity[s] = humidity[s].data();
+    }
+
+    unsigned long checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++) {
+        checksum += decode_records(&memory[0x64], count, BENCH_SENSORS, columns);
+        checksum += temperature[0][i % count];
+    }
+    double seconds = watch.seconds();
+
+    Result result = {"decode/decode_records", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations * count / seconds;
+    result.metrics["checksum"] = (double)checksum;
+    return result;
+}
+
+static Result bench_archive_rows(const Archive &archive, unsigned long iterations)
+{
+    unsigned long checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++)
+        checksum += archive.rows(0, archive.size()).temperatures(0)[i % archive.size()];
+    double seconds = watch.seconds();
+
+    Result result = {"archive/rows", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations * archive.size() / seconds;
+    result.metrics["bytes_per_record"] = (double)(BENCH_SENSORS + 1) * 3 + 8;
+    result.metrics["checksum"] = (double)checksum;
+    return result;
+}
+
+static Result bench_archive_decompress(const CompressedArchive &compressed,
+    size_t compressed_size, unsigned long iterations)
+{
+    unsigned long checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++)
+        checksum += compressed.decode().temperatures(0)[i % compressed.size()];
+    double seconds = watch.seconds();
+
+    Result result = {"archive/decompress", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations * compressed.size() / seconds;
+    result.metrics["bytes_per_record"] = (double)compressed_size / compressed.size();
+    result.metrics["checksum"] = (double)checksum;
+    return result;
+}
+
+static Result bench_format_record(const std::vector<std::vector<byte>> &records,
+    unsigned long iterations)
+{
+    const std::string format = "%#t sensor %#s: %#T°C %#H%% at %c";
+
+    size_t checksum = 0;
+    Stopwatch watch;
+    for (unsigned long i = 0; i < iterations; i++) {
+        const std::vector<byte> &record = records[i % records.size()];
+        Station::SensorRecord sensor(WS8610::parse_temperature(record, 0),
+            WS8610::parse_humidity(record, 0));
+        checksum += format_record(sensor, BENCH_TIMESTAMP + i * 300, "internal", 1, format).size();
+    }
+    double seconds = watch.seconds();
+
+    Result result = {"format/format_record", iterations, seconds, std::map<std::string, double>()};
+    result.metrics["records_per_second"] = iterations / seconds;
+    result.metrics["bytes_per_record"] = (double)checksum / iterations;
+    return result;
+}
+
+
+//
+// Main
+//
+
+int main(int argc, char **argv)
+{
+    //
+    // Command-line parameters
+    //
+
+    // Declare named options
+    po::options_description desc("Program options:");
+    desc.add_options()
+        ("help,h",
+            "produce help message")
+        ("scale",
+            po::value<double>()
+                ->default_value(1.0),
+            "multiplier for the amount of iterations")
+        ("filter",
+            po::value<std::string>()
+                ->default_value(""),
+            "only run benchmarks whose name contains this string")
+        ("output,o",
+            po::value<std::string>(),
+            "file to write the JSON results to (default: standard output)")
+    ;
+
+    // Parse the options
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception &e) {
+        clog(error) << "Invalid usage: " << e.what() << std::endl;
+
+        clog(info) << desc << std::endl;
+        return 1;
+    }
+
+    // Display help
+    if (vm.count("help")) {
+        clog(info) << desc << std::endl;
+        return 0;
+    }
+
+    // Only report errors from the code under test
+    logger.settings.threshold = warning;
+
+
+    //
+    // Run
+    //
+
+    double scale = vm["scale"].as<double>();
+    const std::string &filter = vm["filter"].as<std::string>();
+    auto iterations = [scale](unsigned long base) {
+        unsigned long scaled = (unsigned long)(base * scale);
+        return scaled > 0 ? scaled : 1;
+    };
+    auto selected = [&filter](const std::string &name) {
+        return name.find(filter) != std::string::npos;
+    };
+
+    std::vector<byte> memory = WS8610Emulator::synthesize(BENCH_SENSORS,
+        BENCH_RECORDS, BENCH_TIMESTAMP);
+    auto history = records(memory, 15, BENCH_RECORDS);
+
+    std::vector<Result> results;
+    const size_t lengths[] = {1, 8, 64};
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        std::ostringstream name;
+        name << "serial/read_data/" << lengths[i];
+        if (selected(name.str()))
+            results.push_back(bench_read_data(memory, lengths[i], iterations(512 / lengths[i])));
+    }
+#ifdef HAVE_ASYNC
+    const unsigned int stations[] = {1, 2};
+    for (size_t i = 0; i < sizeof(stations) / sizeof(stations[0]); i++) {
+        std::ostringstream name;
+        name << "async/interleaved/" << stations[i];
+        if (selected(name.str()))
+            results.push_back(bench_async_interleaved(memory, stations[i], 64, iterations(8)));
+    }
+#endif
+    if (selected("ws8610/history"))
+        results.push_back(bench_history(memory, Validation::DOUBLE, iterations(20)));
+    if (selected("ws8610/history_semantic"))
+        results.push_back(bench_history(memory, Validation::SEMANTIC, iterations(20)));
+    if (selected("decode/parse_datetime"))
+        results.push_back(bench_parse_datetime(history, iterations(100000)));
+    if (selected("decode/parse_temperature"))
+        results.push_back(bench_parse_temperature(history, iterations(1000000)));
+    if (selected("decode/parse_humidity"))
+        results.push_back(bench_parse_humidity(history, iterations(1000000)));
+    if (selected("decode/decode_records"))
+        results.push_back(bench_decode_records(memory, iterations(1000)));
+    if (selected("format/format_record"))
+        results.push_back(bench_format_record(history, iterations(100000)));
+
+    if (selected("archive/")) {
+        // Archive a year of records, in chunks like they would be polled
+        const std::string compressed_name = std::string(BENCH_ARCHIVE) + ".compressed";
+        remove(BENCH_ARCHIVE);
+        remove((std::string(BENCH_ARCHIVE) + ".idx").c_str());
+        {
+            Archive archive(BENCH_ARCHIVE, BENCH_SENSORS);
+            for (unsigned int chunk = 0; chunk < 50; chunk++) {
+                std::vector<byte> image = WS8610Emulator::synthesize(BENCH_SENSORS,
+                    BENCH_RECORDS * 2, BENCH_TIMESTAMP + chunk * BENCH_RECORDS * 2 * 300);
+                Station::HistoryBatch batch(BENCH_SENSORS, BENCH_RECORDS * 2);
+                decode_records(&image[0x64], batch.size(), BENCH_SENSORS, RecordColumns{batch.datetimes(),
+                    {batch.temperatures(0), batch.temperatures(1), batch.temperatures(2), batch.temperatures(3)},
+                    {batch.humidities(0), batch.humidities(1), batch.humidities(2), batch.humidities(3)}});
+                archive.append(batch);
+            }
+            CompressedArchive::write(compressed_name, archive);
+        }
+
+        Archive archive(BENCH_ARCHIVE, BENCH_SENSORS);
+        CompressedArchive compressed(compressed_name);
+        std::ifstream file(compressed_name.c_str(), std::ios::binary | std::ios::ate);
+        size_t compressed_size = file.tellg();
+        if (selected("archive/rows"))
+            results.push_back(bench_archive_rows(archive, iterations(20)));
+        if (selected("archive/decompress"))
+            results.push_back(bench_archive_decompress(compressed, compressed_size, iterations(20)));
+        remove(BENCH_ARCHIVE);
+        remove((std::string(BENCH_ARCHIVE) + ".idx").c_str());
+        remove(compressed_name.c_str());
+    }
+
+    if (vm.count("output")) {
+        std::ofstream output(vm["output"].as<std::string>().c_str());
+        if (!output) {
+            clog(error) << "Unable to open output file" << std::endl;
+            return 1;
+        }
+        output << json(results);
+    } else {
+        std::cout << json(results);
+    }
+
+    // Fail when any benchmark produced wrong results
+    for (size_t i = 0; i < results.size(); i++)
+        if (results[i].metrics.count("mismatches") && results[i].metrics["mismatches"] > 0)
+            return 1;
+    return 0;
+}
@@ -0,0 +1,159 @@
+//
+// Configuration
+//
+
+// Header
+#include "civiltime.hpp"
+
+// Standard library
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Configurable values
+#define ZONE_SAMPLE_INTERVAL 21600  // seconds between probes for offset
+                                    // changes when building a zone table
+#define ZONE_MARGIN 172800          // seconds a zone table extends beyond
+                                    // its year, covering any UTC offset
+
+
+//
+// Time zone tables
+//
+
+// Period during which the local time zone has a fixed offset from UTC
+struct Period
+{
+    time_t start;
+    long offset;
+};
+
+// Periods covering a single year, in chronological order
+typedef std::vector<Period> Zone;
+
+static long utc_offset(time_t time)
+{
+    struct tm timeinfo;
+    localtime_r(&time, &timeinfo);
+    return timeinfo.tm_gmtoff;
+}
+
+// Find the offset changes within a year by probing the zone at regular
+// intervals, and bisecting every interval in which the offset changed
+static Zone build_zone(int year)
+{
+    time_t begin = (time_t)days_from_civil(year, 1, 1) * 86400 - ZONE_MARGIN;
+    time_t end = (time_t)days_from_civil(year + 1, 1, 1) * 86400 + ZONE_MARGIN;
+
+    Zone zone;
+    long offset = utc_offset(begin);
+    Period first = {begin, offset};
+    zone.push_back(first);
+    for (time_t time = begin; time < end; ) {
+        time_t next = std::min(time + ZONE_SAMPLE_INTERVAL, end);
+        long next_offset = utc_offset(next);
+        if (next_offset != offset) {
+            time_t low = time, high = next;
+            while (high - low > 1) {
+                time_t middle = low + (high - low) / 2;
+                if (utc_offset(middle) == offset)
+                    low = middle;
+                else
+                    high = middle;
+            }
+            Period period = {high, next_offset};
+            zone.push_back(period);
+            offset = next_offset;
+        }
+        time = next;
+    }
+
+    return zone;
+}
+
+// Tables are built once per year and never removed, so references to them
+// stay valid after the lock has been released
+static const Zone &zone(int year)
+{
+    static thread_local int cached_year = INT_MIN;
+    static thread_local const Zone *cached_zone = 0;
+    if (year == cached_year)
+        return *cached_zone;
+
+    static std::mutex mutex;
+    static std::map<int, Zone> zones;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = zones.find(year);
+    if (entry == zones.end()) {
+        if (zones.empty())
+            tzset();
+        entry = zones.insert(std::make_pair(year, build_zone(year))).first;
+    }
+
+    cached_year = year;
+    cached_zone = &entry->second;
+    return *cached_zone;
+}
+
+
+//
+// Conversion
+//
+
+/**
+ * Count the days between the epoch and a date in the proleptic Gregorian
+ * calendar.
+ * @param year  Year.
+ * @param month Month (1 to 12).
+ * @param day   Day of the month, values beyond the length of the month
+ *              continue into the next ones.
+ * @return      Amount of days since 1970-01-01.
+ */
+int64_t days_from_civil(int year, unsigned int month, unsigned int day)
+{
+    // Count years from March, so the leap day ends the year
+    year -= (month <= 2);
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int year_of_era = (unsigned int)(year - era * 400);
+    unsigned int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+/**
+ * Convert a local wall-clock time to epoch time, like mktime() does with
+ * tm_isdst set to -1. Times which occur twice when the clock is turned back
+ * resolve to the first occurrence, times skipped when the clock is turned
+ * forward are interpreted using the offset from before the change.
+ * @param year   Year.
+ * @param month  Month (1 to 12).
+ * @param day    Day of the month.
+ * @param hour   Hour.
+ * @param minute Minute.
+ * @return       Epoch time, or -1 if the date is invalid.
+ */
+time_t local_to_epoch(int year, unsigned int month, unsigned int day,
+    unsigned int hour, unsigned int minute)
+{
+    if (month < 1 || month > 12)
+        return -1;
+
+    time_t local = (time_t)days_from_civil(year, month, day) * 86400
+        + hour * 3600 + minute * 60;
+
+    const Zone &periods = zone(year);
+    size_t candidate = 0;
+    for (size_t i = 0; i < periods.size(); i++) {
+        time_t time = local - periods[i].offset;
+        if (time < periods[i].start)
+            break;
+        if (i + 1 == periods.size() || time < periods[i + 1].start)
+            return time;
+        candidate = i;
+    }
+
+    // The time was skipped when the clock was turned forward
+    return local - periods[candidate].offset;
+}
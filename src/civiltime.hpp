@@ -0,0 +1,24 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_CIVILTIME_
+#define _OPENLACROSSE_CIVILTIME_
+
+// Standard library
+#include <cstdint>
+#include <ctime>
+
+
+//
+// Module definitions
+//
+
+// Conversion of calendar dates and local wall-clock times to epoch time,
+// without going through mktime()
+int64_t days_from_civil(int year, unsigned int month, unsigned int day);
+time_t local_to_epoch(int year, unsigned int month, unsigned int day,
+    unsigned int hour, unsigned int minute);
+
+#endif
@@ -0,0 +1,269 @@
+//
+// Configuration
+//
+
+// Header
+#include "collector.hpp"
+
+// Standard library
+#include <stdexcept>
+#include <thread>
+
+// Platform
+#include <pthread.h>
+#include <sched.h>
+
+// Local includes
+#include "auxiliary.hpp"
+#include "daemon.hpp"
+
+// Configurable values
+#define CONNECT_RETRY_INTERVAL 30   // seconds before retrying to connect
+
+
+//
+// Auxiliary
+//
+
+// Pin the calling thread to one of the CPUs it is allowed to run on,
+// spreading consecutive workers over different ones
+static void pin_worker(size_t index)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return;
+    int cpus = CPU_COUNT(&allowed);
+    if (cpus == 0)
+        return;
+
+    int target = (int)(index % cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || target-- > 0)
+            continue;
+
+        cpu_set_t pinned;
+        CPU_ZERO(&pinned);
+        CPU_SET(cpu, &pinned);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) == 0)
+            clog(debug) << "Pinned worker " << index << " to CPU " << cpu << std::endl;
+        return;
+    }
+}
+
+
+//
+// Pipeline
+//
+
+Pipeline::Pipeline()
+    : _producers(0)
+{
+}
+
+// Register a producer, before any consumer starts waiting
+void Pipeline::open()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _producers++;
+}
+
+void Pipeline::push(const Delivery &delivery)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push_back(delivery);
+    }
+    _changed.notify_one();
+}
+
+void Pipeline::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _producers--;
+    }
+    _changed.notify_one();
+}
+
+/**
+ * Take the oldest delivery out of the pipeline, waiting for one to arrive.
+ * @param delivery Delivery to replace.
+ * @return         Whether a delivery was taken, or all producers are done.
+ */
+bool Pipeline::pop(Delivery &delivery)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_queue.empty() && _producers > 0)
+        _changed.wait(lock);
+    if (_queue.empty())
+        return false;
+
+    delivery = _queue.front();
+    _queue.pop_front();
+    return true;
+}
+
+PipelineSink::PipelineSink(Pipeline &pipeline, size_t source)
+    : _pipeline(pipeline), _source(source)
+{
+}
+
+void PipelineSink::write(const Station::HistoryBatch &batch, const Statistics &statistics)
+{
+    Pipeline::Delivery delivery = {_source, batch, statistics};
+    _pipeline.push(delivery);
+}
+
+
+//
+// Construction and destruction
+//
+
+/**
+ * Prepare to collect records from several stations.
+ * @param factory  Opens a session with the station on a device.
+ * @param interval Seconds between polls of every station.
+ */
+Collector::Collector(const Factory &factory, unsigned int interval)
+    : _factory(factory), _interval(interval)
+{
+}
+
+
+//
+// Configuration
+//
+
+/**
+ * Add a station to collect the records of.
+ * @param device Device the station is connected to.
+ * @param since  Time of the last record collected before, -1 to start with
+ *               the entire history, or none to start at the last record.
+ * @return       Index of the station.
+ */
+size_t Collector::add_station(const std::string &device, boost::optional<time_t> since)
+{
+    Source source;
+    source.device = device;
+    source.since = since;
+    _sources.push_back(source);
+    return _sources.size() - 1;
+}
+
+/**
+ * Add a sink to hand the records of a station to.
+ * @param station Index of the station.
+ * @param sink    Sink, which the collector takes ownership of.
+ */
+void Collector::add_sink(size_t station, Sink *sink)
+{
+    _sources.at(station).sinks.push_back(std::shared_ptr<Sink>(sink));
+}
+
+/**
+ * Keep a file up to date with the statistics of all stations.
+ * @param filename File to replace after every poll.
+ */
+void Collector::set_statistics_file(const std::string &filename)
+{
+    _statistics_file = filename;
+}
+
+
+//
+// Operation
+//
+
+/**
+ * Collect records until SIGINT or SIGTERM is received, handing them to the
+ * sinks from the calling thread.
+ */
+void Collector::run()
+{
+    Daemon::handle_signals();
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < _sources.size(); i++)
+        _pipeline.open();
+    for (size_t i = 0; i < _sources.size(); i++)
+        workers.push_back(std::thread(&Collector::work, this, i));
+
+    Pipeline::Delivery delivery;
+    while (_pipeline.pop(delivery))
+        deliver(delivery);
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+
+//
+// Auxiliary
+//
+
+// Body of the worker thread of a station, which only accesses the station
+// itself and the pipeline
+void Collector::work(size_t index)
+{
+    const std::string device = _sources[index].device;
+    const boost::optional<time_t> since = _sources[index].since;
+    pin_worker(index);
+
+    std::unique_ptr<Station> station;
+    while (!station && !Daemon::stopping()) {
+        try {
+            station.reset(_factory(device));
+        }
+        catch (std::exception const &e) {
+            clog(error) << "Error connecting to " << device << ": " << e.what() << std::endl;
+            Daemon::wait(time(0) + CONNECT_RETRY_INTERVAL);
+        }
+    }
+
+    if (station) {
+        try {
+            time_t last = -1;
+            if (since)
+                last = *since;
+            else if (station->history_count() > 0)
+                last = station->history_last().datetime;
+
+            Daemon daemon(*station, _interval, last);
+            daemon.add_sink(new PipelineSink(_pipeline, index));
+            daemon.run();
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << "Error collecting from " << device << ": " << e.what() << std::endl;
+        }
+    }
+
+    _pipeline.close();
+}
+
+// Hand a delivery to the sinks of its station, and update the statistics
+void Collector::deliver(const Pipeline::Delivery &delivery)
+{
+    Source &source = _sources[delivery.source];
+    source.statistics = delivery.statistics;
+    for (size_t i = 0; i < source.sinks.size(); i++) {
+        try {
+            source.sinks[i]->write(delivery.batch, delivery.statistics);
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << "Error writing records of " << source.device << ": "
+                << e.what() << std::endl;
+        }
+    }
+
+    if (!_statistics_file.empty()) {
+        std::vector<std::pair<std::string, Statistics>> devices;
+        for (size_t i = 0; i < _sources.size(); i++)
+            devices.push_back(std::make_pair(_sources[i].device, _sources[i].statistics));
+        try {
+            write_statistics(_statistics_file, devices);
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << e.what() << std::endl;
+        }
+    }
+}
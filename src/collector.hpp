@@ -0,0 +1,125 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_COLLECTOR_
+#define _OPENLACROSSE_COLLECTOR_
+
+// Standard library
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <ctime>
+
+// Boost
+#include <boost/optional.hpp>
+
+// Local includes
+#include "station.hpp"
+#include "statistics.hpp"
+#include "sink.hpp"
+
+
+//
+// Module definitions
+//
+
+// Thread-safe queue carrying the records collected by several producers to
+// a single consumer, which is done once every producer closed its end
+class Pipeline
+{
+public:
+    // Subclasses
+    struct Delivery
+    {
+        size_t source;
+        Station::HistoryBatch batch;
+        Statistics statistics;
+    };
+
+    // Construction and destruction
+    Pipeline();
+
+    // Producers
+    void open();
+    void push(const Delivery &delivery);
+    void close();
+
+    // Consumer
+    bool pop(Delivery &delivery);
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<Delivery> _queue;
+    size_t _producers;
+};
+
+// Hands records to a pipeline, tagged with the source they were read from
+class PipelineSink : public Sink
+{
+public:
+    // Construction and destruction
+    PipelineSink(Pipeline &pipeline, size_t source);
+
+    // Output
+    void write(const Station::HistoryBatch &batch, const Statistics &statistics);
+
+private:
+    Pipeline &_pipeline;
+    size_t _source;
+};
+
+// Collects the records of several stations at once. Every station gets a
+// worker thread of its own, pinned to a CPU, which opens the session and
+// keeps polling it like a Daemon, so the timing of one port does not hold
+// back the others. The records flow through a pipeline to the calling
+// thread, which hands them to the sinks of their station, so sinks never
+// have to be thread-safe.
+class Collector
+{
+public:
+    // Subclasses
+    typedef std::function<Station *(const std::string &device)> Factory;
+
+    // Construction and destruction
+    Collector(const Factory &factory, unsigned int interval);
+
+    // Configuration
+    size_t add_station(const std::string &device, boost::optional<time_t> since);
+    void add_sink(size_t station, Sink *sink);
+    void set_statistics_file(const std::string &filename);
+
+    // Operation
+    void run();
+
+private:
+    // Subclasses
+    struct Source
+    {
+        std::string device;
+        boost::optional<time_t> since;  // none to start at the last record
+        std::vector<std::shared_ptr<Sink>> sinks;
+        Statistics statistics;
+    };
+
+    // Auxiliary
+    void work(size_t index);
+    void deliver(const Pipeline::Delivery &delivery);
+
+    // Configuration
+    Factory _factory;
+    unsigned int _interval;
+    std::vector<Source> _sources;
+    std::string _statistics_file;
+
+    // Records flowing from the workers
+    Pipeline _pipeline;
+};
+
+#endif
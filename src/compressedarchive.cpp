@@ -0,0 +1,404 @@
+//
+// Configuration
+//
+
+// Header
+#include "compressedarchive.hpp"
+
+// Standard library
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// Configurable values
+#define COMPRESSED_MAGIC "OLAC"
+#define COMPRESSED_VERSION 1
+#define COMPRESSED_HEADER_SIZE 16
+#define BLOCK_RECORDS 1024          // records per block
+#define BLOCK_HEADER_SIZE 14
+#define HISTORY_INTERVAL 300
+#define COLUMN_BITMAP 0x01          // column flag: unavailable values follow
+
+
+//
+// Auxiliary
+//
+
+static void put(std::vector<byte> &buffer, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buffer.push_back((byte)(value >> (8 * i)));
+}
+
+static uint64_t get(const byte *buffer, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= (uint64_t)buffer[i] << (8 * i);
+    return value;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static unsigned int width(uint64_t value)
+{
+    unsigned int bits = 0;
+    for (; value; value >>= 1)
+        bits++;
+    return bits;
+}
+
+// Packs values of a fixed width, least significant bit first
+class BitWriter
+{
+public:
+    BitWriter(std::vector<byte> &output) : _output(output), _buffer(0), _bits(0) { }
+
+    void put(uint64_t value, unsigned int width)
+    {
+        if (width > 32) {
+            put(value & 0xFFFFFFFF, 32);
+            put(value >> 32, width - 32);
+            return;
+        }
+        _buffer |= value << _bits;
+        _bits += width;
+        for (; _bits >= 8; _bits -= 8, _buffer >>= 8)
+            _output.push_back((byte)_buffer);
+    }
+
+    void flush()
+    {
+        if (_bits)
+            _output.push_back((byte)_buffer);
+        _buffer = 0;
+        _bits = 0;
+    }
+
+private:
+    std::vector<byte> &_output;
+    uint64_t _buffer;
+    unsigned int _bits;
+};
+
+class BitReader
+{
+public:
+    BitReader(const byte *input) : _input(input), _buffer(0), _bits(0) { }
+
+    uint64_t get(unsigned int width)
+    {
+        if (width > 32) {
+            uint64_t low = get(32);
+            return low | get(width - 32) << 32;
+        }
+        while (_bits < width) {
+            _buffer |= (uint64_t)*_input++ << _bits;
+            _bits += 8;
+        }
+        uint64_t value = _buffer & ((1ULL << width) - 1);
+        _buffer >>= width;
+        _bits -= width;
+        return value;
+    }
+
+private:
+    const byte *_input;
+    uint64_t _buffer;
+    unsigned int _bits;
+};
+
+// Encode a column of readings, carrying the last available value over the
+// unavailable ones so they do not disturb the differences
+static void encode_column(std::vector<byte> &output, const int64_t *values,
+    size_t count, int64_t unavailable)
+{
+    std::vector<int64_t> filled(values, values + count);
+    std::vector<byte> bitmap((count + 7) / 8, 0);
+    bool missing = false;
+    int64_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] != unavailable) {
+            last = values[i];
+            break;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (values[i] == unavailable) {
+            filled[i] = last;
+            bitmap[i / 8] |= (byte)(1 << (i % 8));
+            missing = true;
+        } else {
+            last = values[i];
+        }
+    }
+
+    unsigned int bits = 0;
+    for (size_t i = 1; i < count; i++)
+        bits = std::max(bits, width(zigzag(filled[i] - filled[i - 1])));
+
+    output.push_back(missing ? COLUMN_BITMAP : 0);
+    output.push_back((byte)bits);
+    put(output, (uint64_t)filled[0], 2);
+    if (missing)
+        output.insert(output.end(), bitmap.begin(), bitmap.end());
+    BitWriter writer(output);
+    for (size_t i = 1; i < count; i++)
+        writer.put(zigzag(filled[i] - filled[i - 1]), bits);
+    writer.flush();
+}
+
+// Make sure a part of a block lies within it before decoding it, as blocks
+// are only checked to lie within the file
+static void require(const byte *input, size_t length, const byte *end)
+{
+    if (length > (size_t)(end - input))
+        throw std::runtime_error("Invalid compressed archive");
+}
+
+// Size of a bit-packed sequence of differences following the first value
+static size_t packed_size(size_t count, unsigned int bits)
+{
+    if (bits > 64)
+        throw std::runtime_error("Invalid compressed archive");
+    return ((count - 1) * bits + 7) / 8;
+}
+
+template <typename T>
+static const byte *decode_column(const byte *input, const byte *end, T *values,
+    size_t count, T unavailable)
+{
+    require(input, 4, end);
+    byte flags = input[0];
+    unsigned int bits = input[1];
+    int64_t value = (int16_t)get(input + 2, 2);
+    input += 4;
+    const byte *bitmap = 0;
+    if (flags & COLUMN_BITMAP) {
+        require(input, (count + 7) / 8, end);
+        bitmap = input;
+        input += (count + 7) / 8;
+    }
+    require(input, packed_size(count, bits), end);
+
+    values[0] = (T)value;
+    if (bits == 0) {
+        std::fill(values, values + count, (T)value);
+    } else {
+        BitReader reader(input);
+        for (size_t i = 1; i < count; i++) {
+            value += unzigzag(reader.get(bits));
+            values[i] = (T)value;
+        }
+    }
+    input += packed_size(count, bits);
+
+    if (bitmap)
+        for (size_t i = 0; i < count; i++)
+            if (bitmap[i / 8] & (1 << (i % 8)))
+                values[i] = unavailable;
+    return input;
+}
+
+
+//
+// Construction and destruction
+//
+
+/**
+ * Open a compressed archive, and locate its blocks.
+ * @param filename File holding the compressed archive.
+ */
+CompressedArchive::CompressedArchive(const std::string &filename)
+    : _external_sensors(0), _records(0)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Unable to open compressed archive");
+    _data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (_data.size() < COMPRESSED_HEADER_SIZE || memcmp(_data.data(), COMPRESSED_MAGIC, 4) != 0)
+        throw std::runtime_error("Invalid compressed archive");
+    if (get(&_data[4], 4) != COMPRESSED_VERSION)
+        throw std::runtime_error("Unsupported compressed archive version");
+    _external_sensors = (unsigned int)get(&_data[8], 4);
+    if (_external_sensors > 3)
+        throw std::runtime_error("Invalid compressed archive");
+
+    size_t location = COMPRESSED_HEADER_SIZE;
+    while (location < _data.size()) {
+        if (location + BLOCK_HEADER_SIZE > _data.size())
+            throw std::runtime_error("Truncated compressed archive");
+        size_t length = (size_t)get(&_data[location], 4);
+        if (location + 4 + length > _data.size())
+            throw std::runtime_error("Truncated compressed archive");
+
+        Block block = {location, _records, (size_t)get(&_data[location + 4], 2)};
+        if (4 + length < BLOCK_HEADER_SIZE || block.count == 0)
+            throw std::runtime_error("Invalid compressed archive");
+        _blocks.push_back(block);
+        _records += block.count;
+        location += 4 + length;
+    }
+}
+
+
+//
+// Creation
+//
+
+/**
+ * Compress an archive into a new file.
+ * @param filename File to write, replaced atomically.
+ * @param archive  Archive to compress.
+ */
+void CompressedArchive::write(const std::string &filename, const Archive &archive)
+{
+    std::vector<byte> buffer(COMPRESSED_MAGIC, COMPRESSED_MAGIC + 4);
+    put(buffer, COMPRESSED_VERSION, 4);
+    put(buffer, archive.external_sensors(), 4);
+    put(buffer, BLOCK_RECORDS, 4);
+
+    for (size_t begin = 0; begin < archive.size(); begin += BLOCK_RECORDS) {
+        Station::HistoryBatch batch = archive.rows(begin, begin + BLOCK_RECORDS);
+        encode_block(batch, 0, batch.size(), buffer);
+    }
+
+    const std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary.c_str(), std::ios::binary);
+    file.write((const char *)buffer.data(), buffer.size());
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) < 0)
+        throw std::runtime_error("Unable to write compressed archive");
+}
+
+
+//
+// Decoding
+//
+
+time_t CompressedArchive::block_first(size_t block) const
+{
+    return (time_t)(int64_t)get(&_data[_blocks[block].location + 6], 8);
+}
+
+Station::HistoryBatch CompressedArchive::decode(size_t block) const
+{
+    Station::HistoryBatch batch(_external_sensors, _blocks[block].count);
+    decode_block(&_data[_blocks[block].location], batch, 0);
+    return batch;
+}
+
+Station::HistoryBatch CompressedArchive::decode() const
+{
+    Station::HistoryBatch batch(_external_sensors, _records);
+    for (size_t i = 0; i < _blocks.size(); i++)
+        decode_block(&_data[_blocks[i].location], batch, _blocks[i].first_record);
+    return batch;
+}
+
+
+//
+// Block codec
+//
+
+/**
+ * Append a block holding a range of records to a buffer.
+ * @param batch  Records.
+ * @param begin  Index of the first record to encode.
+ * @param end    Index past the last record to encode, at most 65535
+ *               records after the first.
+ * @param output Buffer to append to.
+ */
+void CompressedArchive::encode_block(const Station::HistoryBatch &batch, size_t begin,
+    size_t end, std::vector<byte> &output)
+{
+    size_t count = end - begin;
+    if (count == 0 || count > 0xFFFF)
+        throw std::invalid_argument("Invalid block size");
+
+    size_t start = output.size();
+    put(output, 0, 4);
+    put(output, count, 2);
+    put(output, (uint64_t)(int64_t)batch.datetime(begin), 8);
+
+    // Timestamps, as difference from the recording interval
+    std::vector<uint64_t> delta(count);
+    unsigned int bits = 0;
+    for (size_t i = 1; i < count; i++) {
+        delta[i] = zigzag((int64_t)batch.datetime(begin + i)
+            - batch.datetime(begin + i - 1) - HISTORY_INTERVAL);
+        bits = std::max(bits, width(delta[i]));
+    }
+    output.push_back((byte)bits);
+    BitWriter writer(output);
+    for (size_t i = 1; i < count; i++)
+        writer.put(delta[i], bits);
+    writer.flush();
+
+    // Readings
+    std::vector<int64_t> values(count);
+    for (unsigned int s = 0; s <= batch.external_sensors(); s++) {
+        std::copy(batch.temperatures(s) + begin, batch.temperatures(s) + end, values.begin());
+        encode_column(output, values.data(), count, TEMPERATURE_UNAVAILABLE);
+        std::copy(batch.humidities(s) + begin, batch.humidities(s) + end, values.begin());
+        encode_column(output, values.data(), count, HUMIDITY_UNAVAILABLE);
+    }
+
+    size_t length = output.size() - start - 4;
+    for (size_t i = 0; i < 4; i++)
+        output[start + i] = (byte)(length >> (8 * i));
+}
+
+/**
+ * Decode a block into a batch, rejecting blocks whose contents do not fit
+ * their length.
+ * @param data   Block.
+ * @param batch  Batch to decode into, large enough to hold the block.
+ * @param offset Index of the batch to decode the first record to.
+ * @return       Amount of records decoded.
+ */
+size_t CompressedArchive::decode_block(const byte *data, Station::HistoryBatch &batch,
+    size_t offset)
+{
+    size_t count = (size_t)get(data + 4, 2);
+    if (offset + count > batch.size())
+        throw std::invalid_argument("Batch too small for block");
+    const byte *input = data + BLOCK_HEADER_SIZE;
+    const byte *end = data + 4 + get(data, 4);
+
+    time_t *datetime = batch.datetimes() + offset;
+    datetime[0] = (time_t)(int64_t)get(data + 6, 8);
+    require(input, 1, end);
+    unsigned int bits = *input++;
+    require(input, packed_size(count, bits), end);
+    if (bits == 0) {
+        for (size_t i = 1; i < count; i++)
+            datetime[i] = datetime[i - 1] + HISTORY_INTERVAL;
+    } else {
+        BitReader reader(input);
+        for (size_t i = 1; i < count; i++)
+            datetime[i] = datetime[i - 1] + HISTORY_INTERVAL + unzigzag(reader.get(bits));
+    }
+    input += packed_size(count, bits);
+
+    for (unsigned int s = 0; s <= batch.external_sensors(); s++) {
+        input = decode_column<int16_t>(input, end, batch.temperatures(s) + offset, count,
+            TEMPERATURE_UNAVAILABLE);
+        input = decode_column<uint8_t>(input, end, batch.humidities(s) + offset, count,
+            HUMIDITY_UNAVAILABLE);
+    }
+
+    return count;
+}
@@ -0,0 +1,73 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_COMPRESSEDARCHIVE_
+#define _OPENLACROSSE_COMPRESSEDARCHIVE_
+
+// Standard library
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+// Local includes
+#include "global.hpp"
+#include "station.hpp"
+#include "archive.hpp"
+
+
+//
+// Module definitions
+//
+
+// Compressed copy of an archive, made up of blocks of consecutive records
+// which can each be decoded on their own. Within a block, every column
+// stores its first value followed by the zig-zag encoded differences
+// between consecutive values, bit-packed at the width of the largest one.
+// Timestamps are stored as their difference from the recording interval,
+// so a block without gaps only takes a few bytes for them. Unavailable
+// readings are marked in a bitmap, which is only present if there are any.
+class CompressedArchive
+{
+public:
+    // Construction and destruction
+    CompressedArchive(const std::string &filename);
+
+    // Creation
+    static void write(const std::string &filename, const Archive &archive);
+
+    // Properties
+    unsigned int external_sensors() const { return _external_sensors; }
+    size_t blocks() const { return _blocks.size(); }
+    size_t size() const { return _records; }
+
+    // Decoding
+    time_t block_first(size_t block) const;
+    Station::HistoryBatch decode(size_t block) const;
+    Station::HistoryBatch decode() const;
+
+    // Block codec
+    static void encode_block(const Station::HistoryBatch &batch, size_t begin,
+        size_t end, std::vector<byte> &output);
+    static size_t decode_block(const byte *data, Station::HistoryBatch &batch,
+        size_t offset);
+
+private:
+    // Contents
+    std::vector<byte> _data;
+    unsigned int _external_sensors;
+    size_t _records;
+
+    // Location and record offset of every block
+    struct Block
+    {
+        size_t location;
+        size_t first_record;
+        size_t count;
+    };
+    std::vector<Block> _blocks;
+};
+
+#endif
@@ -0,0 +1,156 @@
+//
+// Configuration
+//
+
+// Header
+#include "daemon.hpp"
+
+// Standard library
+#include <algorithm>
+#include <stdexcept>
+
+// Platform
+#include <unistd.h>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define RETRY_INTERVAL 30   // seconds before retrying a failed poll
+#define STOP_CHECK_INTERVAL 1   // seconds between checks whether to stop,
+                                // as other threads miss the signal
+
+// Lock-free, so it can be set from the signal handler while workers poll it
+std::atomic<bool> Daemon::_stopping(false);
+static_assert(ATOMIC_BOOL_LOCK_FREE == 2, "Stopping from a signal handler requires a lock-free flag");
+
+static void handle_signal(int)
+{
+    Daemon::stop();
+}
+
+
+//
+// Construction and destruction
+//
+
+/**
+ * Prepare to collect records from a station.
+ * @param station  Station to poll, with an open session.
+ * @param interval Seconds between polls.
+ * @param since    Time of the last record collected before, or -1 to start
+ *                 with the entire history.
+ */
+Daemon::Daemon(Station &station, unsigned int interval, time_t since)
+    : _station(station), _interval(std::max(interval, 1u)), _last(since),
+      _suspect(false)
+{
+}
+
+
+//
+// Configuration
+//
+
+/**
+ * Add a sink to hand the collected records to.
+ * @param sink Sink, which the daemon takes ownership of.
+ */
+void Daemon::add_sink(Sink *sink)
+{
+    _sinks.push_back(std::unique_ptr<Sink>(sink));
+}
+
+
+//
+// Operation
+//
+
+/**
+ * Poll the station until SIGINT or SIGTERM is received. Polls are scheduled
+ * at fixed intervals from the start, skipping those missed, while a failed
+ * poll is retried sooner.
+ */
+void Daemon::run()
+{
+    handle_signals();
+
+    clog(info) << "Polling the station every " << _interval << " seconds" << std::endl;
+    time_t start = time(0);
+    while (!_stopping) {
+        bool success = poll();
+
+        time_t now = time(0);
+        time_t next = start + ((now - start) / _interval + 1) * _interval;
+        if (!success)
+            next = std::min(next, now + RETRY_INTERVAL);
+        wait(next);
+    }
+    clog(info) << "Stopping" << std::endl;
+}
+
+/**
+ * Collect the records written since the previous poll, reopening the session
+ * first if it was dropped, and hand them to the sinks.
+ * @return Whether the station could be read.
+ */
+bool Daemon::poll()
+{
+    Station::HistoryBatch batch;
+    try {
+        if (_suspect || !_station.responsive()) {
+            clog(info) << "Reopening the station session" << std::endl;
+            _suspect = true;
+            _station.connect();
+            _suspect = false;
+        }
+
+        batch = _station.history_since(_last);
+        clog(debug) << "Collected " << batch.size() << " new records" << std::endl;
+        if (!batch.empty())
+            _last = batch.datetime(batch.size() - 1);
+    }
+    catch (std::runtime_error const &e) {
+        clog(error) << "Error polling the station: " << e.what() << std::endl;
+        _suspect = true;
+        return false;
+    }
+
+    // A failing sink should not hold back the others
+    for (size_t i = 0; i < _sinks.size(); i++) {
+        try {
+            _sinks[i]->write(batch, _station.statistics());
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << "Error writing records: " << e.what() << std::endl;
+        }
+    }
+    return true;
+}
+
+// Stop all daemons on SIGINT and SIGTERM
+void Daemon::handle_signals()
+{
+    struct sigaction action;
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;   // interrupt the sleep between polls
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+}
+
+// Only touches a flag, so it can be called from a signal handler
+void Daemon::stop()
+{
+    _stopping = true;
+}
+
+/**
+ * Sleep until a point in time, or until asked to stop.
+ * @param deadline Point in time.
+ */
+void Daemon::wait(time_t deadline)
+{
+    for (time_t now = time(0); !_stopping && now < deadline; now = time(0))
+        sleep((unsigned int)std::min(deadline - now, (time_t)STOP_CHECK_INTERVAL));
+}
@@ -0,0 +1,59 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_DAEMON_
+#define _OPENLACROSSE_DAEMON_
+
+// Standard library
+#include <vector>
+#include <memory>
+#include <ctime>
+#include <atomic>
+#include <csignal>
+
+// Local includes
+#include "station.hpp"
+#include "sink.hpp"
+
+
+//
+// Module definitions
+//
+
+// Keeps the session with a station open, and collects the records written
+// since the previous poll on a fixed schedule, handing them to the sinks.
+// The session is only reopened when a poll finds it dropped or failed.
+class Daemon
+{
+public:
+    // Construction and destruction
+    Daemon(Station &station, unsigned int interval, time_t since);
+
+    // Configuration
+    void add_sink(Sink *sink);
+
+    // Operation
+    void run();
+    bool poll();
+    static void handle_signals();
+    static void stop();
+    static bool stopping() { return _stopping; }
+    static void wait(time_t deadline);
+
+private:
+    // Collection state
+    Station &_station;
+    unsigned int _interval;
+    time_t _last;
+    bool _suspect;
+
+    // Sinks, owned by the daemon
+    std::vector<std::unique_ptr<Sink>> _sinks;
+
+    // Set from signal handlers
+    static std::atomic<bool> _stopping;
+};
+
+#endif
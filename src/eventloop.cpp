@@ -0,0 +1,231 @@
+//
+// Configuration
+//
+
+// Header
+#include "eventloop.hpp"
+
+// Standard library
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Platform
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define MAX_EVENTS 16   // events handled per wakeup
+
+
+//
+// Construction and destruction
+//
+
+EventLoop::EventLoop()
+    : _epoll(-1), _timer(-1), _armed(0), _sequence(0), _stopping(false)
+{
+    _epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll < 0)
+        throw std::runtime_error("Unable to create event loop: " + std::string(strerror(errno)));
+
+    _timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = _timer;
+    if (_timer < 0 || epoll_ctl(_epoll, EPOLL_CTL_ADD, _timer, &event) < 0) {
+        if (_timer >= 0)
+            close(_timer);
+        close(_epoll);
+        throw std::runtime_error("Unable to create event loop timer: " + std::string(strerror(errno)));
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    // Suspended coroutines belong to the tasks, which are destroyed first
+    _tasks.clear();
+    close(_timer);
+    close(_epoll);
+}
+
+
+//
+// Awaitables
+//
+
+bool EventLoop::Sleep::await_ready() const
+{
+    return _deadline <= monotonic_ns();
+}
+
+/**
+ * Suspend the awaiting coroutine for a while.
+ * @param ns Time to suspend, in nanoseconds.
+ */
+EventLoop::Sleep EventLoop::sleep(uint64_t ns)
+{
+    return Sleep(*this, monotonic_ns() + ns);
+}
+
+EventLoop::Ready EventLoop::readable(int fd)
+{
+    return Ready(*this, fd, EPOLLIN);
+}
+
+EventLoop::Ready EventLoop::writable(int fd)
+{
+    return Ready(*this, fd, EPOLLOUT);
+}
+
+
+//
+// Operation
+//
+
+/**
+ * Start a task, which runs until it first suspends.
+ * @param task Task, which the loop takes ownership of.
+ */
+void EventLoop::spawn(Task<void> task)
+{
+    _tasks.push_back(std::move(task));
+    _tasks.back().handle().resume();
+}
+
+/**
+ * Resume suspended coroutines as their timers expire and file descriptors
+ * become ready, until every task completed or the loop is stopped.
+ */
+void EventLoop::run()
+{
+    _stopping = false;
+    for (;;) {
+        reap();
+        if (_stopping || _tasks.empty())
+            return;
+
+        if (resume_expired())
+            continue;
+        if (_timers.empty() && _watchers.empty())
+            throw std::logic_error("Tasks are suspended without anything to wait for");
+        wait();
+    }
+}
+
+// Make run() return once the current coroutine suspends
+void EventLoop::stop()
+{
+    _stopping = true;
+}
+
+
+//
+// Auxiliary
+//
+
+void EventLoop::schedule(uint64_t deadline, std::coroutine_handle<> handle)
+{
+    Timer timer = {deadline, _sequence++, handle};
+    _timers.push(timer);
+}
+
+void EventLoop::watch(int fd, uint32_t events, std::coroutine_handle<> handle)
+{
+    if (_watchers.count(fd))
+        throw std::logic_error("File descriptor is already being waited for");
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+        throw std::runtime_error("Unable to wait for file descriptor: " + std::string(strerror(errno)));
+    _watchers[fd] = handle;
+}
+
+// Resume the coroutines whose deadline passed, without entering the kernel
+// when that is the case already
+bool EventLoop::resume_expired()
+{
+    uint64_t now = monotonic_ns();
+    if (_timers.empty() || _timers.top().deadline > now)
+        return false;
+
+    while (!_timers.empty() && _timers.top().deadline <= now) {
+        std::coroutine_handle<> handle = _timers.top().handle;
+        _timers.pop();
+        handle.resume();
+    }
+    return true;
+}
+
+// Arm the timer for the earliest deadline, unless it already is
+void EventLoop::arm()
+{
+    uint64_t deadline = _timers.empty() ? 0 : _timers.top().deadline;
+    if (deadline == _armed)
+        return;
+
+    struct itimerspec expiry;
+    memset(&expiry, 0, sizeof(expiry));
+    expiry.it_value.tv_sec = deadline / 1000000000ULL;
+    expiry.it_value.tv_nsec = deadline % 1000000000ULL;
+    if (timerfd_settime(_timer, TFD_TIMER_ABSTIME, &expiry, 0) < 0)
+        throw std::runtime_error("Unable to arm event loop timer: " + std::string(strerror(errno)));
+    _armed = deadline;
+}
+
+// Block until the timer expires or a file descriptor is ready
+void EventLoop::wait()
+{
+    arm();
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(_epoll, events, MAX_EVENTS, -1);
+    if (count < 0 && errno != EINTR)
+        throw std::runtime_error("Unable to wait for events: " + std::string(strerror(errno)));
+
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == _timer) {
+            uint64_t expirations;
+            if (read(_timer, &expirations, sizeof(expirations)) > 0)
+                _armed = 0;
+            continue;
+        }
+
+        auto watcher = _watchers.find(fd);
+        if (watcher == _watchers.end())
+            continue;
+        std::coroutine_handle<> handle = watcher->second;
+        _watchers.erase(watcher);
+        epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, 0);
+        handle.resume();
+    }
+}
+
+// Drop the tasks which completed, reporting those which failed
+void EventLoop::reap()
+{
+    for (auto task = _tasks.begin(); task != _tasks.end();) {
+        if (!task->done()) {
+            ++task;
+            continue;
+        }
+
+        try {
+            task->result();
+        }
+        catch (std::exception const &e) {
+            clog(error) << "Task failed: " << e.what() << std::endl;
+        }
+        task = _tasks.erase(task);
+    }
+}
@@ -0,0 +1,121 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_EVENTLOOP_
+#define _OPENLACROSSE_EVENTLOOP_
+
+// Standard library
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <queue>
+#include <vector>
+
+// Local includes
+#include "task.hpp"
+
+
+//
+// Module definitions
+//
+
+// Single-threaded event loop resuming coroutines once a point in time has
+// passed or a file descriptor became ready. All timers share one timerfd,
+// armed for the earliest deadline, which is waited for with epoll along with
+// the file descriptors, so one thread can interleave the bus transactions of
+// many stations with other I/O.
+class EventLoop
+{
+public:
+    // Suspends the awaiting coroutine until a point in time
+    class Sleep
+    {
+    public:
+        Sleep(EventLoop &loop, uint64_t deadline) : _loop(loop), _deadline(deadline) { }
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle) { _loop.schedule(_deadline, handle); }
+        void await_resume() const { }
+
+    private:
+        EventLoop &_loop;
+        uint64_t _deadline;
+    };
+
+    // Suspends the awaiting coroutine until a file descriptor is ready
+    class Ready
+    {
+    public:
+        Ready(EventLoop &loop, int fd, uint32_t events)
+            : _loop(loop), _fd(fd), _events(events) { }
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { _loop.watch(_fd, _events, handle); }
+        void await_resume() const { }
+
+    private:
+        EventLoop &_loop;
+        int _fd;
+        uint32_t _events;
+    };
+
+    // Construction and destruction
+    EventLoop();
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Awaitables
+    Sleep sleep(uint64_t ns);
+    Sleep sleep_until(uint64_t deadline) { return Sleep(*this, deadline); }
+    Ready readable(int fd);
+    Ready writable(int fd);
+
+    // Operation
+    void spawn(Task<void> task);
+    void run();
+    void stop();
+
+private:
+    // Subclasses
+    struct Timer
+    {
+        uint64_t deadline;
+        uint64_t sequence;  // keeps timers with equal deadlines in order
+        std::coroutine_handle<> handle;
+
+        bool operator>(const Timer &other) const
+        {
+            return deadline != other.deadline ? deadline > other.deadline
+                : sequence > other.sequence;
+        }
+    };
+
+    // Auxiliary
+    void schedule(uint64_t deadline, std::coroutine_handle<> handle);
+    void watch(int fd, uint32_t events, std::coroutine_handle<> handle);
+    bool resume_expired();
+    void arm();
+    void wait();
+    void reap();
+
+    // Kernel objects
+    int _epoll;
+    int _timer;
+    uint64_t _armed;
+
+    // Suspended coroutines
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+    uint64_t _sequence;
+    std::map<int, std::coroutine_handle<>> _watchers;
+
+    // Top-level tasks, owned by the loop
+    std::list<Task<void>> _tasks;
+    bool _stopping;
+};
+
+#endif
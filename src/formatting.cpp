@@ -0,0 +1,75 @@
+//
+// Configuration
+//
+
+// Header
+#include "formatting.hpp"
+
+// Standard library
+#include <sstream>
+#include <stdexcept>
+
+
+//
+// Formatting
+//
+
+std::string format_record(const Station::SensorRecord &record, time_t datetime, std::string type, unsigned int sensor, const std::string &format)
+{
+    std::stringstream format_stream;
+
+    Formatting::Mode formatting = Formatting::RAW;
+    for (size_t i = 0; i < format.size(); i++) {
+        char current = format[i];
+        if (formatting == Formatting::RAW) {
+            switch (current) {
+                case '%':
+                    formatting = Formatting::STRFTIME;
+                    break;
+                default:
+                    format_stream << current;
+            }
+        } else if (formatting == Formatting::STRFTIME) {
+            switch (current) {
+                case '#':
+                    formatting = Formatting::CUSTOM;
+                    break;
+                default:
+                    const std::string time_format = format.substr(i-1, 2).c_str();
+                    char time_string[256];
+                    if (strftime(time_string, 256, time_format.c_str(), localtime(&datetime)))
+                    	format_stream << time_string;
+                    else
+                        throw std::runtime_error("invalid datetime formatting flag");
+
+                    formatting = Formatting::RAW;
+            }
+        } else if (formatting == Formatting::CUSTOM) {
+            switch (current) {
+                case 'T':
+                    if (record.temperature)
+                        format_stream << *record.temperature;
+                    else
+                        format_stream << "-";
+                    break;
+                case 'H':
+                    if (record.humidity)
+                        format_stream << *record.humidity;
+                    else
+                        format_stream << "-";
+                    break;
+                case 't':
+                	format_stream << type;
+                    break;
+                case 's':
+                    format_stream << sensor;
+                    break;
+                default:
+                    throw std::runtime_error("invalid sensor formatting flag");
+            }
+            formatting = Formatting::RAW;
+        }
+    }
+
+    return format_stream.str();
+}
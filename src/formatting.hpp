@@ -0,0 +1,33 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_FORMATTING_
+#define _OPENLACROSSE_FORMATTING_
+
+// Standard library
+#include <string>
+#include <ctime>
+
+// Local includes
+#include "station.hpp"
+
+
+//
+// Module definitions
+//
+
+namespace Formatting
+{
+    enum Mode
+    {
+        RAW,
+        STRFTIME,
+        CUSTOM
+    };
+};
+
+std::string format_record(const Station::SensorRecord &record, time_t datetime, std::string type, unsigned int sensor, const std::string &format);
+
+#endif
@@ -0,0 +1,64 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_LINEDRIVER_
+#define _OPENLACROSSE_LINEDRIVER_
+
+// Standard library
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Local includes
+#include "global.hpp"
+
+
+//
+// Module definitions
+//
+
+class HardwareException : public std::runtime_error
+{
+public:
+    HardwareException(const std::string& message)
+        : std::runtime_error(message) { };
+};
+
+// Modem lines
+namespace Line
+{
+    enum Name
+    {
+        DTR = 1 << 0,
+        RTS = 1 << 1,
+        CTS = 1 << 2,
+        DSR = 1 << 3
+    };
+    const int OUTPUTS = DTR | RTS;
+};
+
+// Primitive access to the modem lines and byte stream of a serial port
+class LineDriver
+{
+public:
+    // Construction and destruction
+    virtual ~LineDriver() { }
+
+    // Modem lines
+    virtual void set_lines(int lines) = 0;
+    virtual int get_lines() = 0;
+
+    // Block until any of the input lines in the mask changes, or the timeout
+    // expires. Drivers which cannot wait for changes return false, in which
+    // case the caller has to poll instead.
+    virtual bool wait_lines(int, unsigned int) { return false; }
+
+    // Byte stream
+    virtual std::vector<byte> read_device(size_t length) = 0;
+    virtual void write_device(const std::vector<byte> &data) = 0;
+};
+
+#endif
@@ -4,8 +4,14 @@
 
 // Standard library
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <set>
 
 // Boost
 #include <boost/program_options.hpp>
@@ -14,7 +20,18 @@ namespace po = boost::program_options;
 #include <boost/exception/all.hpp>
 
 // Local includes
+#include "archive.hpp"
 #include "auxiliary.hpp"
+#include "civiltime.hpp"
+#include "collector.hpp"
+#include "compressedarchive.hpp"
+#include "daemon.hpp"
+#include "formatting.hpp"
+#include "mirror.hpp"
+#include "profiles.hpp"
+#include "realtime.hpp"
+#include "sink.hpp"
+#include "statistics.hpp"
 #include "ws8610.hpp"
 
 // Supported models
@@ -38,82 +55,171 @@ namespace Model
     }
 };
 
+// Validation modes
+namespace Validation
+{
+    std::istream& operator>>(std::istream& in, Mode& mode)
+    {
+        std::string token;
+        in >> token;
+        if (boost::iequals(token, "double"))
+            mode = DOUBLE;
+        else if (boost::iequals(token, "semantic"))
+            mode = SEMANTIC;
+        else
+            throw po::validation_error(
+                po::validation_error::invalid_option_value,
+                "Unknown validation mode");
+        return in;
+    }
+};
 
-//
-// Main
-//
+// Parse a point in time given as local "YYYY-MM-DD[ HH:MM]". As an upper
+// bound, it stands for the last second of the day or minute given.
+time_t parse_time(const std::string &text, bool upper = false)
+{
+    int year = 0;
+    unsigned int month = 0, day = 0, hour = 0, minute = 0;
+    char trailing;
+    int fields = sscanf(text.c_str(), "%d-%u-%u %u:%u %c", &year, &month, &day,
+        &hour, &minute, &trailing);
 
+    // The first day of the following month bounds the day
+    int next_year = (month == 12) ? year + 1 : year;
+    unsigned int next_month = month % 12 + 1;
+    int64_t days = (month >= 1 && month <= 12)
+        ? days_from_civil(next_year, next_month, 1) - days_from_civil(year, month, 1) : 0;
 
-namespace Formatting
+    time_t datetime = -1;
+    if ((fields == 3 || fields == 5) && day >= 1 && day <= days && hour < 24 && minute < 60) {
+        if (!upper)
+            datetime = local_to_epoch(year, month, day, hour, minute);
+        else if (fields == 5)
+            datetime = local_to_epoch(year, month, day, hour, minute) + 59;
+        else if (day < days)
+            datetime = local_to_epoch(year, month, day + 1, 0, 0) - 1;
+        else
+            datetime = local_to_epoch(next_year, next_month, 1, 0, 0) - 1;
+    }
+    if (datetime == -1)
+        throw po::validation_error(
+            po::validation_error::invalid_option_value,
+            "Invalid point in time");
+    return datetime;
+}
+
+// Apply the bus settings of a device. Its edge delay is the one given
+// explicitly, or the one it was tuned to before. When requested, the device
+// is tuned first, once per run, and its profile persisted.
+void configure_bus(WS8610 &ws8610, const std::string &device, const po::variables_map &vm)
 {
-    enum Mode
-    {
-        RAW,
-        STRFTIME,
-        CUSTOM
-    };
-};
+    if (vm.count("realtime"))
+        ws8610.set_realtime_priority(vm["realtime"].as<int>());
+
+    // Stations collected at once are configured from their own threads
+    static std::mutex mutex;
+    static std::set<std::string> tuned;
+    std::lock_guard<std::mutex> lock(mutex);
 
-std::string format_record(const Station::SensorRecord &record, time_t datetime, std::string type, unsigned int sensor, const std::string &format)
+    ws8610.set_edge_delay(vm["edge-delay"].as<unsigned int>());
+    Profiles profiles(vm["profiles"].as<std::string>());
+    profiles.load();
+    if (vm.count("tune") && tuned.insert(device).second) {
+        unsigned int ns = ws8610.tune();
+        clog(info) << "Tuned the edge delay of " << device << " to " << ns << " ns" << std::endl;
+        profiles.set_edge_delay(device, ns);
+        profiles.save();
+    } else if (vm["edge-delay"].defaulted()) {
+        boost::optional<unsigned int> ns = profiles.edge_delay(device);
+        if (ns) {
+            clog(debug) << "Using the edge delay of " << *ns << " ns tuned for " << device << std::endl;
+            ws8610.set_edge_delay(*ns);
+        }
+    }
+}
+
+// Display every sensor reading of a record
+void display_record(const Station::HistoryRecord &record, const std::string &format)
 {
-    std::stringstream format_stream;
-
-    Formatting::Mode formatting = Formatting::RAW;
-    for (size_t i = 0; i < format.size(); i++) {
-        char current = format[i];
-        if (formatting == Formatting::RAW) {
-            switch (current) {
-                case '%':
-                    formatting = Formatting::STRFTIME;
-                    break;
-                default:
-                    format_stream << current;
-            }
-        } else if (formatting == Formatting::STRFTIME) {
-            switch (current) {
-                case '#':
-                    formatting = Formatting::CUSTOM;
-                    break;
-                default:
-                    const std::string time_format = format.substr(i-1, 2).c_str();
-                    char time_string[256];
-                    if (strftime(time_string, 256, time_format.c_str(), localtime(&datetime)))
-                    	format_stream << time_string;
-                    else
-                        throw std::runtime_error("invalid datetime formatting flag");
-
-                    formatting = Formatting::RAW;
-            }
-        } else if (formatting == Formatting::CUSTOM) {
-            switch (current) {
-                case 'T':
-                    if (record.temperature)
-                        format_stream << *record.temperature;
-                    else
-                        format_stream << "-";
-                    break;
-                case 'H':
-                    if (record.humidity)
-                        format_stream << *record.humidity;
-                    else
-                        format_stream << "-";
-                    break;
-                case 't':
-                	format_stream << type;
-                    break;
-                case 's':
-                    format_stream << sensor;
-                    break;
-                default:
-                    throw std::runtime_error("invalid sensor formatting flag");
+    clog(info) << format_record(record.internal, record.datetime, "internal", 1, format) << std::endl;
+    for (size_t i = 0; i < record.external.size(); i++)
+        clog(info) << format_record(record.external[i], record.datetime, "external", i+1, format) << std::endl;
+}
+
+// Keep polling the station, handing new records to the configured sinks
+int collect(Station &station, const po::variables_map &vm)
+{
+    try {
+        // Continue where the archive left off, or only collect new records
+        time_t since = -1;
+        if (vm.count("archive"))
+            since = Archive::latest(vm["archive"].as<std::string>());
+        else if (station.history_count() > 0)
+            since = station.history_last().datetime;
+
+        Daemon daemon(station, vm["interval"].as<unsigned int>(), since);
+        daemon.add_sink(new FormatSink(vm["format"].as<std::string>()));
+        if (vm.count("archive"))
+            daemon.add_sink(new ArchiveSink(vm["archive"].as<std::string>()));
+        if (vm.count("stats-file"))
+            daemon.add_sink(new StatisticsSink(vm["stats-file"].as<std::string>(),
+                vm["device"].as<std::string>()));
+        daemon.run();
+    }
+    catch (std::runtime_error const &e) {
+        clog(error) << "Error collecting data: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Poll several stations at once, handing their records to the sinks
+int collect_stations(const po::variables_map &vm)
+{
+    const std::vector<std::string> devices = vm["collect"].as<std::vector<std::string>>();
+    const size_t checkpoint = vm["checkpoint"].as<size_t>();
+    const Validation::Mode validation = vm["validation"].as<Validation::Mode>();
+    Collector collector([=](const std::string &device) -> Station * {
+        std::unique_ptr<WS8610> ws8610(new WS8610(device));
+        ws8610->set_checkpoint_interval(checkpoint);
+        ws8610->set_validation(validation);
+        configure_bus(*ws8610, device, vm);
+        return ws8610.release();
+    }, vm["interval"].as<unsigned int>());
+
+    try {
+        for (size_t i = 0; i < devices.size(); i++) {
+            // Continue where the archive left off, or only collect new records
+            boost::optional<time_t> since;
+            std::string archive;
+            if (vm.count("archive")) {
+                std::string name = devices[i].substr(devices[i].find_last_of('/') + 1);
+                archive = vm["archive"].as<std::string>() + "." + name;
+                since = Archive::latest(archive);
             }
-            formatting = Formatting::RAW;
+
+            size_t station = collector.add_station(devices[i], since);
+            collector.add_sink(station, new FormatSink(vm["format"].as<std::string>(), devices[i]));
+            if (!archive.empty())
+                collector.add_sink(station, new ArchiveSink(archive));
         }
-    }
+        if (vm.count("stats-file"))
+            collector.set_statistics_file(vm["stats-file"].as<std::string>());
 
-    return format_stream.str();
+        collector.run();
+    }
+    catch (std::runtime_error const &e) {
+        clog(error) << "Error collecting data: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
 }
 
+
+//
+// Main
+//
+
 int main(int argc, char **argv)
 {
     //
@@ -121,6 +227,9 @@ int main(int argc, char **argv)
     //
     
     // Declare named options
+    const char *home = getenv("HOME");
+    const std::string default_profiles = std::string(home ? home : ".") + "/.lacrosse-profiles";
+
     po::options_description desc("Program options:");
     desc.add_options()
         ("help,h",
@@ -151,6 +260,77 @@ int main(int argc, char **argv)
             " %-prefixed: strftime formatting\n")
 		("dump",
 			"dump memory contents after everything")
+        ("since",
+            po::value<std::string>(),
+            "display the records written at or after this local time,\n"
+            "formatted as YYYY-MM-DD[ HH:MM]")
+        ("until",
+            po::value<std::string>(),
+            "display the records written at or before this local time,\n"
+            "or during this day if no time is given")
+        ("snapshot",
+            "read the entire memory at once, and answer all queries from it")
+        ("mirror",
+            po::value<std::string>(),
+            "persistent copy of the station memory to synchronize, and to\n"
+            "answer all queries from")
+        ("archive",
+            po::value<std::string>(),
+            "archive file to append the records to which are more recent\n"
+            "than the last one it holds")
+        ("compress",
+            po::value<std::string>(),
+            "file to write a compressed copy of the archive to")
+        ("checkpoint",
+            po::value<size_t>()
+                ->default_value(256),
+            "amount of bytes streamed between verifications of bulk reads")
+        ("validation",
+            po::value<Validation::Mode>()
+                ->default_value(Validation::DOUBLE, "double"),
+            "how to verify data read from the station\n"
+            "supported modes: double (read twice and compare),\n"
+            "semantic (read once and check the contents)")
+        ("edge-delay",
+            po::value<unsigned int>()
+                ->default_value(4000),
+            "nanoseconds to let the bus lines settle after every edge,\n"
+            "instead of the delay the device was tuned to")
+        ("realtime",
+            po::value<int>()
+                ->implicit_value(50),
+            "lock memory, pin the bus to a CPU and run transactions at\n"
+            "the given SCHED_FIFO priority (default: 50)")
+        ("cpu",
+            po::value<int>(),
+            "CPU to pin the bus to in real-time mode (default: the last\n"
+            "one available); stations collected at once are spread over\n"
+            "the CPUs instead")
+        ("tune",
+            "find the fastest edge delay the station reliably tolerates,\n"
+            "starting at the given one, and remember it for the device")
+        ("profiles",
+            po::value<std::string>()
+                ->default_value(default_profiles),
+            "file to remember the edge delays of tuned devices in")
+        ("daemon",
+            "keep the session open, and hand the records written since\n"
+            "the previous poll to the output, archive and statistics file\n"
+            "until interrupted")
+        ("interval",
+            po::value<unsigned int>()
+                ->default_value(300),
+            "seconds between polls in daemon mode")
+        ("collect",
+            po::value<std::vector<std::string>>()->multitoken(),
+            "poll the stations on all of the given devices at once, in\n"
+            "daemon mode, appending their records to the archive file\n"
+            "suffixed with the name of the device")
+        ("stats",
+            "display bus and station statistics afterwards")
+        ("stats-file",
+            po::value<std::string>(),
+            "file to write the statistics to in Prometheus text format")
     ;
 
     // Declare positional options
@@ -202,6 +382,21 @@ int main(int argc, char **argv)
     else if (vm.count("quiet"))
         logger.settings.threshold = warning;
 
+    // Keep the bus from being preempted
+    if (vm.count("realtime")) {
+        Realtime::lock_memory();
+        if (!vm.count("collect"))
+            Realtime::pin_thread(vm.count("cpu") ? vm["cpu"].as<int>() : -1);
+    }
+
+
+    //
+    // Collect from several stations
+    //
+
+    if (vm.count("collect"))
+        return collect_stations(vm);
+
 
     //
     // Connect
@@ -211,11 +406,17 @@ int main(int argc, char **argv)
     try {
         switch (vm["model"].as<Model::Name>()) {
             case Model::WS8610:
-                station = new WS8610(vm["device"].as<std::string>());
+            {
+                std::unique_ptr<WS8610> ws8610(new WS8610(vm["device"].as<std::string>()));
+                ws8610->set_checkpoint_interval(vm["checkpoint"].as<size_t>());
+                ws8610->set_validation(vm["validation"].as<Validation::Mode>());
+                configure_bus(*ws8610, vm["device"].as<std::string>(), vm);
+                station = ws8610.release();
                 break;
+            }
         }
     }
-    catch (std::runtime_error const &e) {
+    catch (std::exception const &e) {
         clog(error) << "Error connecting to device: " << e.what() << std::endl;
         return 1;
     }
@@ -225,23 +426,72 @@ int main(int argc, char **argv)
     // Read data
     //
     
-    try {
-        auto record = station->history_last();
+    int status = 0;
+    if (vm.count("daemon")) {
+        status = collect(*station, vm);
+    } else {
+        try {
+            if (vm.count("mirror")) {
+                Mirror mirror(vm["mirror"].as<std::string>());
+                mirror.load();
+                station->sync(mirror);
+            } else if (vm.count("snapshot")) {
+                station->snapshot();
+            }
 
-        clog(info) << format_record(record.internal, record.datetime, "internal", 1, vm["format"].as<std::string>()) << std::endl;
-        for (size_t i = 0; i < record.external.size(); i++)
-            clog(info) << format_record(record.external[i], record.datetime, "external", i+1, vm["format"].as<std::string>()) << std::endl;
-    }
-    catch (std::runtime_error const &e) {
-        clog(error) << "Error reading data: " << e.what() << std::endl;
-        return 1;
+            const std::string format = vm["format"].as<std::string>();
+            if (vm.count("since") || vm.count("until")) {
+                time_t from = vm.count("since") ? parse_time(vm["since"].as<std::string>()) : -1;
+                time_t to = vm.count("until") ? parse_time(vm["until"].as<std::string>(), true) : -1;
+                Station::HistoryCursor cursor = station->history_cursor(from, to);
+                clog(debug) << "Displaying " << cursor.size() << " records" << std::endl;
+                for (Station::HistoryCursor::iterator it = cursor.begin(); it != cursor.end(); ++it)
+                    display_record(*it, format);
+            } else {
+                display_record(station->history_last(), format);
+            }
+
+            if (vm.count("archive")) {
+                Archive archive(vm["archive"].as<std::string>(), station->external_sensors());
+                size_t appended = archive.append(station->history_since(archive.last()));
+                clog(debug) << "Appended " << appended << " records to the archive, which now holds "
+                    << archive.size() << std::endl;
+
+                if (vm.count("compress"))
+                    CompressedArchive::write(vm["compress"].as<std::string>(), archive);
+            }
+
+            if (vm.count("dump")) {
+                std::vector<byte> memory = station->memory_dump();
+                clog(info) << hexdump(memory.data(), memory.size(), 16);
+            }
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << "Error reading data: " << e.what() << std::endl;
+            status = 1;
+        }
     }
 
-    if (vm.count("dump")) {
-    	std::vector<byte> memory = station->memory_dump();
-    	clog(info) << hexdump(memory.data(), memory.size(), 16);
+
+    //
+    // Statistics
+    //
+
+    // Explicitly requested, so not subject to the log threshold
+    if (vm.count("stats"))
+        std::cout << station->statistics() << std::flush;
+
+    if (vm.count("stats-file")) {
+        try {
+            write_statistics(vm["stats-file"].as<std::string>(), station->statistics(),
+                vm["device"].as<std::string>());
+        }
+        catch (std::runtime_error const &e) {
+            clog(error) << "Error writing statistics: " << e.what() << std::endl;
+            status = 1;
+        }
     }
 
     delete station;
-    return 0;
+    return status;
 }
@@ -0,0 +1,123 @@
+//
+// Configuration
+//
+
+// Header
+#include "mirror.hpp"
+
+// Standard library
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define MIRROR_MAGIC "OLMR"
+#define MIRROR_VERSION 1
+#define MIRROR_MEMORY_SIZE 0x8000
+
+
+//
+// Auxiliary
+//
+
+static void put(std::vector<byte> &buffer, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buffer.push_back((byte)(value >> (8 * i)));
+}
+
+static uint64_t get(const std::vector<byte> &buffer, size_t &offset, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= (uint64_t)buffer[offset + i] << (8 * i);
+    offset += size;
+    return value;
+}
+
+
+//
+// Construction and destruction
+//
+
+Mirror::Mirror(const std::string &filename)
+    : valid(false), memory(MIRROR_MEMORY_SIZE, 0xFF), _filename(filename)
+{
+    memset(&metadata, 0, sizeof(metadata));
+}
+
+
+//
+// Persistence
+//
+
+/**
+ * Load the mirror from disk.
+ * @return Whether a valid mirror was found.
+ */
+bool Mirror::load()
+{
+    valid = false;
+
+    std::ifstream file(_filename.c_str(), std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<byte> buffer((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    const size_t header = 4 + 4 + 4 + 4 + 2 + 8 + 4 + 8;
+    if (buffer.size() != header + MIRROR_MEMORY_SIZE
+        || memcmp(buffer.data(), MIRROR_MAGIC, 4) != 0) {
+        clog(warning) << "Ignoring invalid mirror " << _filename << std::endl;
+        return false;
+    }
+
+    size_t offset = 4;
+    if (get(buffer, offset, 4) != MIRROR_VERSION) {
+        clog(warning) << "Ignoring mirror " << _filename
+            << " with unsupported version" << std::endl;
+        return false;
+    }
+    metadata.record_size = (uint32_t)get(buffer, offset, 4);
+    metadata.record_count = (uint32_t)get(buffer, offset, 4);
+    for (size_t i = 0; i < sizeof(metadata.loop_flags); i++)
+        metadata.loop_flags[i] = (byte)get(buffer, offset, 1);
+    for (size_t i = 0; i < sizeof(metadata.last_download); i++)
+        metadata.last_download[i] = (byte)get(buffer, offset, 1);
+    metadata.frontier = (uint32_t)get(buffer, offset, 4);
+    metadata.synced = (int64_t)get(buffer, offset, 8);
+
+    memory.assign(buffer.begin() + offset, buffer.end());
+    valid = true;
+    return true;
+}
+
+/**
+ * Save the mirror to disk, replacing the previous copy atomically.
+ */
+void Mirror::save() const
+{
+    std::vector<byte> buffer(MIRROR_MAGIC, MIRROR_MAGIC + 4);
+    put(buffer, MIRROR_VERSION, 4);
+    put(buffer, metadata.record_size, 4);
+    put(buffer, metadata.record_count, 4);
+    for (size_t i = 0; i < sizeof(metadata.loop_flags); i++)
+        put(buffer, metadata.loop_flags[i], 1);
+    for (size_t i = 0; i < sizeof(metadata.last_download); i++)
+        put(buffer, metadata.last_download[i], 1);
+    put(buffer, metadata.frontier, 4);
+    put(buffer, (uint64_t)metadata.synced, 8);
+    buffer.insert(buffer.end(), memory.begin(), memory.end());
+
+    const std::string temporary = _filename + ".tmp";
+    std::ofstream file(temporary.c_str(), std::ios::binary);
+    file.write((const char *)buffer.data(), buffer.size());
+    file.close();
+    if (!file || rename(temporary.c_str(), _filename.c_str()) < 0)
+        throw std::runtime_error("Unable to save mirror");
+}
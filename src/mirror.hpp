@@ -0,0 +1,55 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_MIRROR_
+#define _OPENLACROSSE_MIRROR_
+
+// Standard library
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+// Local includes
+#include "global.hpp"
+
+
+//
+// Module definitions
+//
+
+// Persistent local copy of station memory, with the metadata needed to
+// synchronize it incrementally
+class Mirror
+{
+public:
+    // Subclasses
+    struct Metadata
+    {
+        uint32_t record_size;
+        uint32_t record_count;
+        byte loop_flags[2];
+        byte last_download[8];
+        uint32_t frontier;
+        int64_t synced;
+    };
+
+    // Construction and destruction
+    Mirror(const std::string &filename);
+
+    // Persistence
+    bool load();
+    void save() const;
+
+    // Contents
+    bool valid;
+    Metadata metadata;
+    std::vector<byte> memory;
+
+private:
+    std::string _filename;
+};
+
+#endif
@@ -0,0 +1,107 @@
+//
+// Configuration
+//
+
+// Header
+#include "profiles.hpp"
+
+// Standard library
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define PROFILES_HEADER "# OpenLacrosse bus profiles: device, edge delay in ns"
+
+
+//
+// Construction and destruction
+//
+
+Profiles::Profiles(const std::string &filename)
+    : _filename(filename)
+{
+}
+
+
+//
+// Persistence
+//
+
+/**
+ * Load the profiles from disk, skipping lines which cannot be parsed.
+ * @return Whether the file was found.
+ */
+bool Profiles::load()
+{
+    _edge_delays.clear();
+
+    std::ifstream file(_filename.c_str());
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        // Device paths may contain spaces, so split at the last tab
+        size_t separator = line.find_last_of('\t');
+        char *end = 0;
+        unsigned long ns = 0;
+        if (separator != std::string::npos && separator > 0) {
+            const char *value = line.c_str() + separator + 1;
+            ns = strtoul(value, &end, 10);
+            if (end == value || *end != '\0')
+                end = 0;
+        }
+        if (!end) {
+            clog(warning) << "Ignoring invalid line in " << _filename << ": " << line << std::endl;
+            continue;
+        }
+        _edge_delays[line.substr(0, separator)] = (unsigned int)ns;
+    }
+    return true;
+}
+
+/**
+ * Save the profiles to disk, replacing the previous file atomically.
+ */
+void Profiles::save() const
+{
+    const std::string temporary = _filename + ".tmp";
+    std::ofstream file(temporary.c_str());
+    file << PROFILES_HEADER << std::endl;
+    for (auto profile = _edge_delays.begin(); profile != _edge_delays.end(); ++profile)
+        file << profile->first << '\t' << profile->second << std::endl;
+    file.close();
+    if (!file || rename(temporary.c_str(), _filename.c_str()) < 0)
+        throw std::runtime_error("Unable to save profiles to " + _filename);
+}
+
+
+//
+// Contents
+//
+
+/**
+ * Look up the edge delay tuned for a device.
+ * @param device Path of the device.
+ * @return       Delay in nanoseconds, if the device has been tuned.
+ */
+boost::optional<unsigned int> Profiles::edge_delay(const std::string &device) const
+{
+    auto profile = _edge_delays.find(device);
+    if (profile == _edge_delays.end())
+        return boost::none;
+    return profile->second;
+}
+
+void Profiles::set_edge_delay(const std::string &device, unsigned int ns)
+{
+    _edge_delays[device] = ns;
+}
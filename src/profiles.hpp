@@ -0,0 +1,43 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_PROFILES_
+#define _OPENLACROSSE_PROFILES_
+
+// Standard library
+#include <map>
+#include <string>
+
+// Boost
+#include <boost/optional.hpp>
+
+
+//
+// Module definitions
+//
+
+// Bus timings found to work for each device, persisted as a text file with a
+// line per device path, so a tuned device can be reused without probing it
+// again
+class Profiles
+{
+public:
+    // Construction and destruction
+    Profiles(const std::string &filename);
+
+    // Persistence
+    bool load();
+    void save() const;
+
+    // Contents
+    boost::optional<unsigned int> edge_delay(const std::string &device) const;
+    void set_edge_delay(const std::string &device, unsigned int ns);
+
+private:
+    std::string _filename;
+    std::map<std::string, unsigned int> _edge_delays;
+};
+
+#endif
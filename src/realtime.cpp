@@ -0,0 +1,113 @@
+//
+// Configuration
+//
+
+// Header
+#include "realtime.hpp"
+
+// Standard library
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+// Platform
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define REALTIME_POLICY SCHED_FIFO
+
+
+//
+// Memory
+//
+
+/**
+ * Lock the pages of the process into memory, so the bus thread never stalls
+ * on a page fault. Pages are only locked once touched, as populating every
+ * mapping up front would commit the whole stack reservation of each thread
+ * and the allocator arenas. Kernels without on-fault locking only get the
+ * pages currently in use locked.
+ * @return Whether the memory has been locked.
+ */
+bool Realtime::lock_memory()
+{
+    int status = -1;
+#ifdef MCL_ONFAULT
+    status = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+    if (status < 0 && errno == EINVAL)
+#endif
+        status = mlockall(MCL_CURRENT);
+    if (status < 0) {
+        clog(warning) << "Unable to lock memory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    clog(debug) << "Locked memory" << std::endl;
+    return true;
+}
+
+
+//
+// Scheduling
+//
+
+/**
+ * Pin the calling thread to a CPU, so it isn't migrated mid-transaction.
+ * @param cpu CPU to pin to, or -1 for the last one the thread may run on,
+ *            which is least likely to be handling interrupts.
+ * @return    Whether the thread has been pinned.
+ */
+bool Realtime::pin_thread(int cpu)
+{
+    cpu_set_t allowed;
+    if (cpu < 0) {
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+            return false;
+        for (int i = 0; i < CPU_SETSIZE; i++)
+            if (CPU_ISSET(i, &allowed))
+                cpu = i;
+        if (cpu < 0)
+            return false;
+    }
+
+    cpu_set_t pinned;
+    CPU_ZERO(&pinned);
+    CPU_SET(cpu, &pinned);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+    if (result != 0) {
+        clog(warning) << "Unable to pin to CPU " << cpu << ": " << strerror(result) << std::endl;
+        return false;
+    }
+    clog(debug) << "Pinned to CPU " << cpu << std::endl;
+    return true;
+}
+
+Realtime::Scope::Scope(int priority)
+    : _raised(false), _policy(SCHED_OTHER)
+{
+    // Only warn once, as this is attempted for every transaction
+    static std::atomic<bool> warned(false);
+
+    if (priority <= 0 || pthread_getschedparam(pthread_self(), &_policy, &_param) != 0)
+        return;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int result = pthread_setschedparam(pthread_self(), REALTIME_POLICY, &param);
+    if (result != 0) {
+        if (!warned.exchange(true))
+            clog(warning) << "Unable to raise to real-time priority: " << strerror(result) << std::endl;
+        return;
+    }
+    _raised = true;
+}
+
+Realtime::Scope::~Scope()
+{
+    if (_raised)
+        pthread_setschedparam(pthread_self(), _policy, &_param);
+}
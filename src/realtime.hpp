@@ -0,0 +1,45 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_REALTIME_
+#define _OPENLACROSSE_REALTIME_
+
+// Platform
+#include <sched.h>
+
+
+//
+// Module definitions
+//
+
+// Measures keeping the bus thread from being preempted, which stretches the
+// bit timing and makes reads mismatch. They need privileges which are often
+// missing, in which case they warn and leave the process as is.
+namespace Realtime
+{
+    bool lock_memory();
+    bool pin_thread(int cpu = -1);
+
+    // Raises the calling thread to a real-time scheduling class for as long
+    // as it exists, e.g. for the duration of a bus transaction
+    class Scope
+    {
+    public:
+        Scope(int priority);
+        ~Scope();
+
+        bool raised() const { return _raised; }
+
+    private:
+        Scope(const Scope &);
+        Scope &operator=(const Scope &);
+
+        bool _raised;
+        int _policy;
+        struct sched_param _param;
+    };
+}
+
+#endif
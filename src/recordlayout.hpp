@@ -0,0 +1,149 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_RECORDLAYOUT_
+#define _OPENLACROSSE_RECORDLAYOUT_
+
+// Standard library
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Local includes
+#include "global.hpp"
+#include "station.hpp"
+
+
+//
+// Module definitions
+//
+
+// Output columns of a batch decoder, each holding an element per record,
+// with unavailable readings stored as TEMPERATURE_UNAVAILABLE and
+// HUMIDITY_UNAVAILABLE. Columns of sensors which are not decoded can be
+// left null.
+struct RecordColumns
+{
+    time_t *datetime;           // -1 for the delimiter or an invalid date
+    int16_t *temperature[4];    // tenths of degrees Celsius
+    uint8_t *humidity[4];       // percentage
+};
+
+// Record geometry and decoder of a layout, selected once per session
+struct RecordFormat
+{
+    unsigned int external_sensors;
+    size_t record_size;
+    size_t (*decode)(const byte *data, size_t count, const RecordColumns &columns);
+};
+
+
+//
+// Layout-generic decoding
+//
+
+// A layout describes a record format at compile time, and provides:
+//  - RECORD_SIZE and EXTERNAL_SENSORS constants,
+//  - delimiter(record), whether the record is the history delimiter,
+//  - hour(record), the epoch time at the start of the record's hour, or -1,
+//  - hour_key(record), a value identifying that hour without converting it,
+//  - minute(record), the minute within that hour,
+//  - a Sensor<S> template with temperature(record) and humidity(record)
+//    for every sensor, 0 being the internal one.
+// decode_columns<Layout> then decodes every column in a separate pass, with
+// the stride and field locations known at compile time.
+
+// Unroll the passes over the sensor columns
+template <typename Layout, unsigned int SENSOR,
+    bool END = (SENSOR > Layout::EXTERNAL_SENSORS)>
+struct SensorPasses
+{
+    static void decode(const byte *data, size_t count, const RecordColumns &columns)
+    {
+        typedef typename Layout::template Sensor<SENSOR> Sensor;
+
+        if (int16_t *temperature = columns.temperature[SENSOR])
+            for (size_t i = 0; i < count; i++)
+                temperature[i] = Sensor::temperature(data + i * Layout::RECORD_SIZE);
+        if (uint8_t *humidity = columns.humidity[SENSOR])
+            for (size_t i = 0; i < count; i++)
+                humidity[i] = Sensor::humidity(data + i * Layout::RECORD_SIZE);
+
+        SensorPasses<Layout, SENSOR + 1>::decode(data, count, columns);
+    }
+
+    static void clear(const RecordColumns &columns, size_t index)
+    {
+        if (columns.temperature[SENSOR])
+            columns.temperature[SENSOR][index] = TEMPERATURE_UNAVAILABLE;
+        if (columns.humidity[SENSOR])
+            columns.humidity[SENSOR][index] = HUMIDITY_UNAVAILABLE;
+
+        SensorPasses<Layout, SENSOR + 1>::clear(columns, index);
+    }
+};
+
+template <typename Layout, unsigned int SENSOR>
+struct SensorPasses<Layout, SENSOR, true>
+{
+    static void decode(const byte *, size_t, const RecordColumns &) { }
+    static void clear(const RecordColumns &, size_t) { }
+};
+
+/**
+ * Decode a contiguous span of raw records into columns.
+ * @param data    Raw records.
+ * @param count   Amount of records.
+ * @param columns Columns to fill, holding at least count elements.
+ * @return        Amount of records which are not the delimiter.
+ */
+template <typename Layout>
+size_t decode_columns(const byte *data, size_t count, const RecordColumns &columns)
+{
+    // Records are written every few minutes, so the conversion to epoch time
+    // only has to happen once per hour
+    if (time_t *datetime = columns.datetime) {
+        long cached = -1;
+        time_t base = -1;
+        for (size_t i = 0; i < count; i++) {
+            const byte *record = data + i * Layout::RECORD_SIZE;
+            if (Layout::delimiter(record)) {
+                datetime[i] = -1;
+                continue;
+            }
+
+            long key = Layout::hour_key(record);
+            if (key != cached) {
+                base = Layout::hour(record);
+                cached = key;
+            }
+            datetime[i] = (base == -1) ? -1 : base + Layout::minute(record) * 60;
+        }
+    }
+
+    SensorPasses<Layout, 0>::decode(data, count, columns);
+
+    // The delimiter does not hold any readings
+    size_t delimiters = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (Layout::delimiter(data + i * Layout::RECORD_SIZE)) {
+            SensorPasses<Layout, 0>::clear(columns, i);
+            delimiters++;
+        }
+    }
+
+    return count - delimiters;
+}
+
+// Describe a layout for runtime selection
+template <typename Layout>
+RecordFormat record_format()
+{
+    RecordFormat format = {Layout::EXTERNAL_SENSORS, Layout::RECORD_SIZE,
+        &decode_columns<Layout>};
+    return format;
+}
+
+#endif
@@ -6,18 +6,23 @@
 #include "serialinterface.hpp"
 
 // Standard library
-#include <cstring>
-#include <cassert>
+#include <algorithm>
+#include <ctime>
 
 // Platform
-#include <termios.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <errno.h>
-#include <sys/file.h>
 
 // Local includes
 #include "auxiliary.hpp"
+#include "realtime.hpp"
+#include "termiosdriver.hpp"
+#include "timing.hpp"
+
+// Configurable values
+#define EDGE_DELAY 4000         // ns to let the lines settle after an edge
+#define WAIT_SLICE 100          // ms to block on line changes at once
+#define WAIT_POLL_INTERVAL 10   // ms between polls of drivers which cannot
+                                // wait for line changes
 
 
 //
@@ -25,66 +30,17 @@
 //
 
 SerialInterface::SerialInterface(const std::string& portname)
+    : _driver(new TermiosDriver(portname)), _edge_delay(EDGE_DELAY),
+      _realtime_priority(0), _bit_mark(0)
 {
-    // Open the port
-    //clog(info) << "open_weatherstation" << std::endl;
-    if ((_sp = open(portname.c_str(), O_RDWR | O_NOCTTY)) < 0)
-        throw HardwareException("Unable to open serial device");
-    if ( flock(_sp, LOCK_EX) < 0 )
-        throw HardwareException("Serial device is locked by other program");
-
-    // We want full control of what is set by simply resetting entire adtio
-    // struct    
-    struct termios adtio;
-    memset(&adtio, 0, sizeof(adtio));
-
-    // Serial control options
-    adtio.c_cflag &= ~PARENB;      // No parity
-    adtio.c_cflag &= ~CSTOPB;      // One stop bit
-    adtio.c_cflag &= ~CSIZE;       // Character size mask
-    adtio.c_cflag |= CS8;          // Character size 8 bits
-    adtio.c_cflag |= CREAD;        // Enable Receiver
-    //adtio.c_cflag &= ~CREAD;        // Disable Receiver
-    adtio.c_cflag &= ~HUPCL;       // No "hangup"
-    adtio.c_cflag &= ~CRTSCTS;     // No flowcontrol
-    adtio.c_cflag |= CLOCAL;       // Ignore modem control lines
-
-    // Baudrate, for newer systems
-    cfsetispeed(&adtio, BAUDRATE);
-    cfsetospeed(&adtio, BAUDRATE);
-
-    // Local options
-    //   Raw input = clear ICANON, ECHO, ECHOE, and ISIG
-    //   Disable misc other local features = clear FLUSHO, NOFLSH, TOSTOP, PENDIN, and IEXTEN
-    // So we actually clear all flags in adtio.c_lflag
-    adtio.c_lflag = 0;
-
-    // Input options
-    //   Disable parity check = clear INPCK, PARMRK, and ISTRIP
-    //   Disable software flow control = clear IXON, IXOFF, and IXANY
-    //   Disable any translation of CR and LF = clear INLCR, IGNCR, and ICRNL
-    //   Ignore break condition on input = set IGNBRK
-    //   Ignore parity errors just in case = set IGNPAR;
-    // So we can clear all flags except IGNBRK and IGNPAR
-    adtio.c_iflag = IGNBRK|IGNPAR;
-
-    // Output options
-    // Raw output should disable all other output options
-    adtio.c_oflag &= ~OPOST;
-
-    // Time-out options
-    adtio.c_cc[VTIME] = 10;     // timer 1s
-    adtio.c_cc[VMIN] = 0;       // blocking read until 1 char
-
-    if (tcsetattr(_sp, TCSANOW, &adtio) < 0)
-        throw HardwareException("Unable to initialize serial device");
-    tcflush(_sp, TCIOFLUSH);
+    initialize();
 }
 
-SerialInterface::~SerialInterface()
+SerialInterface::SerialInterface(LineDriver *driver)
+    : _driver(driver), _edge_delay(EDGE_DELAY),
+      _realtime_priority(0), _bit_mark(0)
 {
-    tcflush(_sp, TCIOFLUSH);
-    close(_sp);
+    initialize();
 }
 
 
@@ -98,25 +54,10 @@ SerialInterface::~SerialInterface()
  */
 void SerialInterface::set_DTR(bool value)
 {
-    // TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
-    int portstatus;
-    ioctl(_sp, TIOCMGET, &portstatus);   // get current port status
     if (value)
-    {
-        //clog(trace) << "Set DTR" << std::endl;
-        portstatus |= TIOCM_DTR;
-    }
-    else
-    {
-        //clog(trace) << "Clear DTR" << std::endl;
-        portstatus &= ~TIOCM_DTR;
-    }
-    ioctl(_sp, TIOCMSET, &portstatus);   // set current port status
-
-    /*if (value)
-      ioctl(_sp, TIOCMBIS, TIOCM_DTR);
+        set_lines(Line::DTR, 0);
     else
-      ioctl(_sp, TIOCMBIC, TIOCM_DTR);*/
+        set_lines(0, Line::DTR);
 }
 
 /**
@@ -125,27 +66,10 @@ void SerialInterface::set_DTR(bool value)
  */
 void SerialInterface::set_RTS(bool value)
 {
-    //TODO: use TIOCMBIC and TIOCMBIS instead of TIOCMGET and TIOCMSET
-    int portstatus;
-    ioctl(_sp, TIOCMGET, &portstatus);   // get current port status
     if (value)
-    {
-        //clog(trace) << "Set RTS" << std::endl;
-        portstatus |= TIOCM_RTS;
-    }
+        set_lines(Line::RTS, 0);
     else
-    {
-        //clog(trace) << "Clear RTS" << std::endl;
-        portstatus &= ~TIOCM_RTS;
-    }
-    ioctl(_sp, TIOCMSET, &portstatus);   // set current port status
-
-    /*if (value)
-      ioctl(_sp, TIOCMBIS, TIOCM_RTS);
-    else
-      ioctl(_sp, TIOCMBIC, TIOCM_RTS);
-    */
-
+        set_lines(0, Line::RTS);
 }
 
 /**
@@ -154,19 +78,8 @@ void SerialInterface::set_RTS(bool value)
  */
 bool SerialInterface::get_DSR()
 {
-    int portstatus;
-    ioctl(_sp, TIOCMGET, &portstatus);   // get current port status
-
-    if (portstatus & TIOCM_DSR)
-    {
-        //clog(trace) << "Got DSR = 1" << std::endl;
-        return true;
-    }
-    else
-    {
-        //clog(trace) << "Got DSR = 0" << std::endl;
-        return false;
-    }
+    _stats.ioctls++;
+    return (_driver->get_lines() & Line::DSR) != 0;
 }
 
 /**
@@ -175,18 +88,33 @@ bool SerialInterface::get_DSR()
  */
 bool SerialInterface::get_CTS()
 {
-    int portstatus;
-    ioctl(_sp, TIOCMGET, &portstatus);   // get current port status
+    _stats.ioctls++;
+    return (_driver->get_lines() & Line::CTS) != 0;
+}
 
-    if (portstatus & TIOCM_CTS)
-    {
-        //clog(trace) << "Got CTS = 1" << std::endl;
-        return true;
-    }
-    else
-    {
-        //clog(trace) << "Got CTS = 0" << std::endl;
-        return false;
+/**
+ * Wait for the Data Set Ready line to reach a status, blocking on line
+ * changes if the driver supports that, and polling it otherwise. A change
+ * right between checking the line and blocking goes unnoticed, which is why
+ * blocking happens in slices of WAIT_SLICE.
+ * @param value      Status to wait for.
+ * @param timeout_ms Maximal time to wait.
+ * @return           Whether the line reached the status in time.
+ */
+bool SerialInterface::wait_DSR(bool value, unsigned int timeout_ms)
+{
+    uint64_t deadline = monotonic_ns() + timeout_ms * 1000000ULL;
+    for (;;) {
+        _stats.handshake_waits++;
+        if (get_DSR() == value)
+            return true;
+
+        uint64_t now = monotonic_ns();
+        if (now >= deadline)
+            return false;
+        unsigned int remaining = (unsigned int)((deadline - now + 999999) / 1000000);
+        if (!_driver->wait_lines(Line::DSR, std::min(remaining, (unsigned int)WAIT_SLICE)))
+            usleep(std::min(remaining, (unsigned int)WAIT_POLL_INTERVAL) * 1000);
     }
 }
 
@@ -197,16 +125,7 @@ bool SerialInterface::get_CTS()
  */
 std::vector<byte> SerialInterface::read_device(size_t length)
 {
-    std::vector<byte> data(length);
-    size_t ret;
-
-    for (;;) {
-        ret = read(_sp, data.data(), length);
-        if (ret == 0 && errno == EINTR)
-            continue;
-        assert(ret == length);
-        return data;
-    }
+    return _driver->read_device(length);
 }
 
 /**
@@ -215,8 +134,7 @@ std::vector<byte> SerialInterface::read_device(size_t length)
  */
 void SerialInterface::write_device(const std::vector<byte> &data)
 {
-    size_t ret = write(_sp, data.data(), data.size());
-    assert(ret == data.size());
+    _driver->write_device(data);
 }
 
 
@@ -231,9 +149,9 @@ void SerialInterface::write_device(const std::vector<byte> &data)
  */
 bool SerialInterface::request(address location)
 {
-    return send_command(0xA0)
-        && write_byte((uint8_t)(location / 256))
-        && write_byte((uint8_t)(location % 256));
+    Waveform waveform;
+    compile_request(waveform, location);
+    return run(waveform);
 }
 
 /**
@@ -241,15 +159,9 @@ bool SerialInterface::request(address location)
  */
 void SerialInterface::request_next()
 {
-    //clog(debug) << "request_next_byte_seq" << std::endl;
-    set_RTS(true);
-    nanodelay();
-    set_DTR(false);
-    nanodelay();
-    set_DTR(true);
-    nanodelay();
-    set_RTS(false);
-    nanodelay();
+    Waveform waveform;
+    compile_request_next(waveform);
+    run(waveform);
 }
 
 
@@ -263,16 +175,11 @@ void SerialInterface::request_next()
  */
 byte SerialInterface::read_bit()
 {
-    //clog(trace) << "Read bit ..." << std::endl;
-    set_DTR(false);
-    nanodelay();
-    bool status = get_CTS();
-    nanodelay();
-    set_DTR(true);
-    nanodelay();
-    //clog(trace) << "Bit = " << (status ? "0" : "1") << std::endl;
-
-    return (byte)(status ? 0 : 1);
+    Waveform waveform;
+    compile_read_bit(waveform);
+    byte bit;
+    run(waveform, &bit);
+    return bit;
 }
 
 /**
@@ -281,12 +188,9 @@ byte SerialInterface::read_bit()
  */
 void SerialInterface::write_bit(bool bit)
 {
-    //clog(trace) << "Write bit " << (bit ? "1" : "0") << std::endl;
-    set_RTS(!bit);
-    nanodelay();
-    set_DTR(false);
-    nanodelay();
-    set_DTR(true);
+    Waveform waveform;
+    compile_write_bit(waveform, bit);
+    run(waveform);
 }
 
 
@@ -300,14 +204,8 @@ void SerialInterface::write_bit(bool bit)
  */
 byte SerialInterface::read_byte()
 {
-    //clog(trace) << "Read byte ..." << std::endl;
-    byte b = 0;
-    for (size_t i = 0; i < 8; i++)
-    {
-        b *= 2;
-        b += read_bit();
-    }
-    //clog(trace) << "byte = 0x" << std::hex << b << std::endl;
+    byte b;
+    run(_read_first, &b);
     return b;
 }
 
@@ -319,29 +217,9 @@ byte SerialInterface::read_byte()
  */
 bool SerialInterface::write_byte(byte value, bool verify)
 {
-    //clog(trace) << "Send byte 0x" << std::hex << value << std::endl;
-
-    for (size_t i = 0; i < 8; i++)
-    {
-        write_bit((value & 0x80) > 0);
-        value <<= 1;
-    }
-    set_RTS(false);
-    nanodelay();
-
-    bool status = true;
-    if (verify)
-    {
-        status = get_CTS();
-        //TODO: checking value of status, error routine
-        // TODO: exceptions?
-        nanodelay();
-        set_DTR(false);
-        nanodelay();
-        set_DTR(true);
-        nanodelay();
-    }
-    return status;
+    Waveform waveform;
+    compile_write_byte(waveform, value, verify);
+    return run(waveform);
 }
 
 
@@ -357,16 +235,21 @@ bool SerialInterface::write_byte(byte value, bool verify)
  */
 std::vector<byte> SerialInterface::read_data(address location, size_t length)
 {
-    if (!request(location) || !send_command(0xA1))
+    Realtime::Scope realtime(_realtime_priority);
+    if (realtime.raised())
+        _stats.realtime_transactions++;
+
+    Waveform addressing;
+    compile_request(addressing, location);
+    compile_command(addressing, 0xA1, true);
+    if (!run(addressing))
         return std::vector<byte>(); // TODO: error?
 
     std::vector<byte> readdata(length);
-    readdata[0] = read_byte();
-    for (size_t i = 1; i < length; i++) {
-        request_next();
-        readdata[i] = read_byte();
-    }
-    end_command();
+    run(_read_first, &readdata[0]);
+    for (size_t i = 1; i < length; i++)
+        run(_read_next, &readdata[i]);
+    run(_end);
 
     return readdata;
 }
@@ -378,25 +261,17 @@ std::vector<byte> SerialInterface::read_data(address location, size_t length)
  */
 bool SerialInterface::write_data(address location, const std::vector<byte> &data)
 {
-    start_sequence();
-    if (!request(location))
-        return false;
-    for (size_t i = 0; i < data.size(); i++)
-        if (!write_byte(data[i]))
-            return false;
-    end_command();
-
-    start_sequence();
-    for (size_t i = 0; i < 3; i++) 
-        send_command(0xA0, false);
+    Realtime::Scope realtime(_realtime_priority);
+    if (realtime.raised())
+        _stats.realtime_transactions++;
 
-    set_DTR(false);
-    nanodelay();
-    bool result = get_CTS();
-    set_DTR(true);
-    nanodelay();
+    Waveform waveform;
+    compile_write_data(waveform, location, data);
 
-    return result;
+    byte status;
+    if (!run(waveform, &status))
+        return false;
+    return status == 0;
 }
 
 
@@ -412,38 +287,85 @@ bool SerialInterface::write_data(address location, const std::vector<byte> &data
  */
 bool SerialInterface::send_command(byte command, bool verify)
 {
-    set_DTR(false);
-    nanodelay();
-    set_RTS(false);
-    nanodelay();
-    set_RTS(true);
-    nanodelay();
-    set_DTR(true);
-    nanodelay();
-    set_RTS(false);
-    nanodelay();
-
-    return write_byte(command, verify);
+    Waveform waveform;
+    compile_command(waveform, command, verify);
+    return run(waveform);
 }
 
 void SerialInterface::start_sequence()
 {
-    //clog(trace) << "start_sequence" << std::endl;
-    set_RTS(false);
-    nanodelay();
-    set_DTR(false);
-    nanodelay();
+    Waveform waveform;
+    compile_start_sequence(waveform);
+    run(waveform);
 }
 
 void SerialInterface::end_command()
 {
-    //clog(trace) << "end_command" << std::endl;
-    set_RTS(true);
-    nanodelay();
-    set_DTR(false);
-    nanodelay();
-    set_RTS(false);
-    nanodelay();
+    run(_end);
+}
+
+
+//
+// Waveform execution
+//
+
+/**
+ * Execute a precompiled waveform. Transitions are applied against the shadow
+ * copy of the modem lines, so every effective transition costs a single
+ * ioctl and transitions which wouldn't change the lines are skipped.
+ * @param waveform Waveform to execute.
+ * @param sampled  Optional output for the bits sampled from CTS, MSB first.
+ * @return         Whether all acknowledgements were received.
+ */
+bool SerialInterface::run(const Waveform &waveform, byte *sampled)
+{
+    byte value = 0;
+    _stats.bits_written += waveform.bits_written();
+    _bit_mark = monotonic_ns();
+    const std::vector<Waveform::Step> &steps = waveform.steps();
+    for (auto step = steps.begin(); step != steps.end(); ++step) {
+        if (step->opcode == Waveform::DELAY)
+            nanodelay();
+        else if (!execute(*step, value))
+            return false;
+    }
+
+    if (sampled)
+        *sampled = value;
+    return true;
+}
+
+/**
+ * Execute a single step of a waveform, other than a delay, which is left to
+ * the caller so it can wait in its own way.
+ * @param step  Step to execute.
+ * @param value Sample register.
+ * @return      Whether the waveform may continue.
+ */
+bool SerialInterface::execute(const Waveform::Step &step, byte &value)
+{
+    switch (step.opcode) {
+        case Waveform::SET:
+            set_lines(step.set, step.clear);
+            break;
+        case Waveform::DELAY:
+            break;
+        case Waveform::SAMPLE:
+        {
+            _stats.bits_read++;
+            value = (byte)(value * 2 + (get_CTS() ? 0 : 1));
+            uint64_t now = monotonic_ns();
+            _stats.record_bit_latency(now - _bit_mark);
+            _bit_mark = now;
+            break;
+        }
+        case Waveform::ACK:
+            //TODO: checking value of status, error routine
+            if (!get_CTS())
+                return false;
+            break;
+    }
+    return true;
 }
 
 
@@ -451,7 +373,172 @@ void SerialInterface::end_command()
 // Auxiliary
 // 
 
+void SerialInterface::initialize()
+{
+    // Initialize the shadow copy of the modem lines, so that changing a
+    // line doesn't need to read back the current status
+    _lines = _driver->get_lines() & Line::OUTPUTS;
+
+    // Precompile the waveforms used for every byte of a read operation
+    compile_read_byte(_read_first);
+    compile_request_next(_read_next);
+    compile_read_byte(_read_next);
+    compile_end_command(_end);
+
+    // Calibrate the timing engine up front, instead of stalling the first
+    // transaction with it
+    Timing::instance();
+}
+
 void SerialInterface::nanodelay()
 {
-    usleep(4);
+    uint64_t achieved = Timing::instance().wait(_edge_delay);
+
+    _stats.delays++;
+    _stats.delay_ns += achieved;
+    _stats.delay_requested_ns += _edge_delay;
+    _stats.delay_max_ns = std::max(_stats.delay_max_ns, achieved);
+}
+
+/**
+ * Change the output modem lines, using the shadow copy instead of reading
+ * back the current status.
+ * @param set   Lines to set.
+ * @param clear Lines to clear.
+ */
+void SerialInterface::set_lines(int set, int clear)
+{
+    int portstatus = (_lines & ~clear) | set;
+    if (portstatus == _lines)
+        return;
+    _lines = portstatus;
+    _driver->set_lines(_lines);
+    _stats.ioctls++;
+}
+
+
+//
+// Waveform compilation
+//
+
+void SerialInterface::compile_request(Waveform &waveform, address location)
+{
+    compile_command(waveform, 0xA0, true);
+    compile_write_byte(waveform, (uint8_t)(location / 256), true);
+    compile_write_byte(waveform, (uint8_t)(location % 256), true);
+}
+
+void SerialInterface::compile_request_next(Waveform &waveform)
+{
+    waveform.set_RTS(true);
+    waveform.delay();
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.set_DTR(true);
+    waveform.delay();
+    waveform.set_RTS(false);
+    waveform.delay();
+}
+
+void SerialInterface::compile_read_bit(Waveform &waveform)
+{
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.sample();
+    waveform.delay();
+    waveform.set_DTR(true);
+    waveform.delay();
+}
+
+void SerialInterface::compile_write_bit(Waveform &waveform, bool bit)
+{
+    waveform.set_RTS(!bit);
+    waveform.delay();
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.set_DTR(true);
+    waveform.count_written(1);
+}
+
+void SerialInterface::compile_read_byte(Waveform &waveform)
+{
+    for (size_t i = 0; i < 8; i++)
+        compile_read_bit(waveform);
+}
+
+void SerialInterface::compile_write_byte(Waveform &waveform, byte value, bool verify)
+{
+    for (size_t i = 0; i < 8; i++)
+    {
+        compile_write_bit(waveform, (value & 0x80) > 0);
+        value <<= 1;
+    }
+    waveform.set_RTS(false);
+    waveform.delay();
+
+    if (verify)
+    {
+        waveform.ack();
+        waveform.delay();
+        waveform.set_DTR(false);
+        waveform.delay();
+        waveform.set_DTR(true);
+        waveform.delay();
+    }
+}
+
+void SerialInterface::compile_command(Waveform &waveform, byte command, bool verify)
+{
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.set_RTS(false);
+    waveform.delay();
+    waveform.set_RTS(true);
+    waveform.delay();
+    waveform.set_DTR(true);
+    waveform.delay();
+    waveform.set_RTS(false);
+    waveform.delay();
+
+    compile_write_byte(waveform, command, verify);
+}
+
+// Write a range, and sample the status bit of the write command, which is
+// cleared on success
+void SerialInterface::compile_write_data(Waveform &waveform, address location,
+    const std::vector<byte> &data)
+{
+    compile_start_sequence(waveform);
+    compile_request(waveform, location);
+    for (size_t i = 0; i < data.size(); i++)
+        compile_write_byte(waveform, data[i], true);
+    compile_end_command(waveform);
+
+    compile_start_sequence(waveform);
+    for (size_t i = 0; i < 3; i++)
+        compile_command(waveform, 0xA0, false);
+
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.sample();
+    waveform.set_DTR(true);
+    waveform.delay();
+}
+
+void SerialInterface::compile_start_sequence(Waveform &waveform)
+{
+    waveform.set_RTS(false);
+    waveform.delay();
+    waveform.set_DTR(false);
+    waveform.delay();
+}
+
+void SerialInterface::compile_end_command(Waveform &waveform)
+{
+    waveform.set_RTS(true);
+    waveform.delay();
+    waveform.set_DTR(false);
+    waveform.delay();
+    waveform.set_RTS(false);
+    waveform.delay();
 }
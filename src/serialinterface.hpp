@@ -9,39 +9,32 @@
 // Standard library
 #include <string>
 #include <vector>
-#include <stdexcept>
+#include <memory>
 
 // Local includes
 #include "global.hpp"
-
-// Configurable values
-#define BAUDRATE B300
-#define BUFFER_SIZE 16384
+#include "linedriver.hpp"
+#include "statistics.hpp"
+#include "waveform.hpp"
 
 
 //
 // Module definitions
 //
 
-class HardwareException : std::runtime_error
-{
-public:
-    HardwareException(const std::string& message)
-        : std::runtime_error(message) { };
-};
-
 class SerialInterface
 {
 public:
     // Construction and destruction
     SerialInterface(const std::string& portname);
-    ~SerialInterface();
+    SerialInterface(LineDriver *driver);
 
     // Low-level port interface
     void set_DTR(bool value);
     void set_RTS(bool value);
     bool get_DSR();
     bool get_CTS();
+    bool wait_DSR(bool value, unsigned int timeout_ms);
     std::vector<byte> read_device(size_t length);
     void write_device(const std::vector<byte> &data);
 
@@ -66,12 +59,62 @@ public:
     void start_sequence();
     void end_command();
 
+    // Waveform execution
+    bool run(const Waveform &waveform, byte *sampled = 0);
+    bool execute(const Waveform::Step &step, byte &value);
+
+    // Timing
+    void set_edge_delay(unsigned int ns) { _edge_delay = ns; }
+    unsigned int edge_delay() const { return _edge_delay; }
+    void set_realtime_priority(int priority) { _realtime_priority = priority; }
+
+    // Statistics
+    Statistics &statistics() { return _stats; }
+
     // Auxiliary
 private:
-    void nanodelay();
+    // Asynchronous execution reuses the precompiled waveforms
+    friend class AsyncSerialInterface;
 
-    // Serial port filehandle
-    int _sp;
+    void initialize();
+    void nanodelay();
+    void set_lines(int set, int clear);
+
+    // Waveform compilation
+    static void compile_request(Waveform &waveform, address location);
+    static void compile_request_next(Waveform &waveform);
+    static void compile_read_bit(Waveform &waveform);
+    static void compile_write_bit(Waveform &waveform, bool bit);
+    static void compile_read_byte(Waveform &waveform);
+    static void compile_write_byte(Waveform &waveform, byte value, bool verify);
+    static void compile_command(Waveform &waveform, byte command, bool verify);
+    static void compile_write_data(Waveform &waveform, address location,
+        const std::vector<byte> &data);
+    static void compile_start_sequence(Waveform &waveform);
+    static void compile_end_command(Waveform &waveform);
+
+    // Line driver
+    std::unique_ptr<LineDriver> _driver;
+
+    // Shadow copy of the output modem lines
+    int _lines;
+
+    // Time to let the lines settle after every edge, in nanoseconds
+    unsigned int _edge_delay;
+
+    // Real-time priority of transactions, or 0 to leave the scheduling as is
+    int _realtime_priority;
+
+    // When the previous bit was sampled, or the running waveform started
+    uint64_t _bit_mark;
+
+    // Counters
+    Statistics _stats;
+
+    // Precompiled waveforms
+    Waveform _read_first;
+    Waveform _read_next;
+    Waveform _end;
 };
 
 #endif
@@ -0,0 +1,278 @@
+//
+// Configuration
+//
+
+// Standard library
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// Platform
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Boost
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+// Local includes
+#include "auxiliary.hpp"
+#include "termiosdriver.hpp"
+#include "ws8610emulator.hpp"
+
+// Configurable values
+#define READ_BUFFER_SIZE 4096
+#define IDLE_TIMEOUT 1000   // ms without traffic after which a session is
+                            // considered finished
+
+
+//
+// Simulation
+//
+
+// Per-session bookkeeping
+struct Session
+{
+    Session() : number(0), line_changes(0), line_polls(0), magic_bytes(0),
+        reported(true) { }
+    unsigned int number;
+    unsigned long line_changes;
+    unsigned long line_polls;
+    unsigned long magic_bytes;
+    bool reported;
+    struct timespec start;
+    struct timespec last;
+};
+
+static double elapsed(const struct timespec &start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Set by the signal handler to stop serving
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int)
+{
+    stopping = 1;
+}
+
+static void report(Session &session)
+{
+    if (session.reported)
+        return;
+    session.reported = true;
+    clog(info) << "Session " << session.number << ": "
+        << session.line_changes << " line changes, "
+        << session.line_polls << " line polls, "
+        << session.magic_bytes << " magic bytes in "
+        << (elapsed(session.start) - elapsed(session.last)) << " s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    //
+    // Command-line parameters
+    //
+
+    // Declare named options
+    po::options_description desc("Program options:");
+    desc.add_options()
+        ("help,h",
+            "produce help message")
+        ("quiet,q",
+            "only display errors and warnings")
+        ("verbose,v",
+            "display some more details")
+        ("sensors",
+            po::value<unsigned int>()
+                ->default_value(3),
+            "amount of external sensors to simulate")
+        ("records",
+            po::value<unsigned int>()
+                ->default_value(1000),
+            "amount of history records to simulate")
+        ("image",
+            po::value<std::string>(),
+            "raw memory image to serve instead of a synthesized one")
+        ("link",
+            po::value<std::string>(),
+            "symlink to create pointing to the simulated device")
+    ;
+
+    // Parse the options
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception &e) {
+        clog(error) << "Invalid usage: " << e.what() << std::endl;
+
+        clog(info) << desc << std::endl;
+        return 1;
+    }
+
+    // Display help
+    if (vm.count("help")) {
+        clog(info) << desc << std::endl;
+        return 0;
+    }
+
+    // Set log-level
+    if (vm.count("verbose"))
+        logger.settings.threshold = debug;
+    else if (vm.count("quiet"))
+        logger.settings.threshold = warning;
+
+
+    //
+    // Initialization
+    //
+
+    std::vector<byte> memory;
+    try {
+        if (vm.count("image"))
+            memory = WS8610Emulator::load(vm["image"].as<std::string>());
+        else
+            memory = WS8610Emulator::synthesize(vm["sensors"].as<unsigned int>(),
+                vm["records"].as<unsigned int>(), time(0));
+    }
+    catch (std::exception const &e) {
+        clog(error) << "Error creating memory image: " << e.what() << std::endl;
+        return 1;
+    }
+    WS8610Emulator emulator(memory);
+
+    // Create the pseudo-terminal pair
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        clog(error) << "Unable to create pseudo-terminal: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string slavename = ptsname(master);
+
+    // Keep the slave side open, so sessions can come and go without the
+    // master reporting a hangup
+    int slave = open(slavename.c_str(), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        clog(error) << "Unable to open pseudo-terminal: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (vm.count("link")) {
+        const std::string &link = vm["link"].as<std::string>();
+        unlink(link.c_str());
+        if (symlink(slavename.c_str(), link.c_str()) < 0) {
+            clog(error) << "Unable to create symlink: " << strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+
+    clog(info) << "Simulating WS8610 on " << slavename << std::endl;
+
+
+    //
+    // Serve
+    //
+
+    // Serve until interrupted, without restarting the blocking calls so the
+    // loop notices
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
+
+    int status = 0;
+    Session session;
+    std::vector<byte> magic;
+    unsigned int magic_strings = 0;
+    byte buffer[READ_BUFFER_SIZE];
+    while (!stopping && status == 0) {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        int ready = poll(&pfd, 1, IDLE_TIMEOUT);
+        if (ready == 0) {
+            // A session which went idle is over, even if it was aborted
+            // after its first magic string
+            report(session);
+            magic_strings = 0;
+            continue;
+        }
+        if (ready < 0 && errno == EINTR)
+            continue;
+
+        ssize_t length = read(master, buffer, sizeof(buffer));
+        if (length < 0) {
+            if (errno == EINTR)
+                continue;
+            clog(error) << "Error reading pseudo-terminal: " << strerror(errno) << std::endl;
+            status = 1;
+            break;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &session.last);
+        for (ssize_t i = 0; i < length; i++) {
+            byte value = buffer[i];
+            if (value == 'U') {
+                magic.push_back(value);
+                continue;
+            }
+
+            // Every session sends two magic strings, the first one of which
+            // starts the handshake
+            if (!magic.empty()) {
+                if (magic_strings++ % 2 == 0) {
+                    report(session);
+                    session.number++;
+                    session.line_changes = 0;
+                    session.line_polls = 0;
+                    session.magic_bytes = 0;
+                    session.reported = false;
+                    clock_gettime(CLOCK_MONOTONIC, &session.start);
+                    clog(debug) << "Starting session " << session.number << std::endl;
+                }
+                session.magic_bytes += magic.size();
+                emulator.write_device(magic);
+                magic.clear();
+            }
+
+            if ((value & 0xF0) == INBAND_SET) {
+                emulator.set_lines(value & 0x0F);
+                session.line_changes++;
+            } else if (value == INBAND_GET) {
+                byte reply = (byte)(INBAND_STATUS | emulator.get_lines());
+                if (write(master, &reply, 1) != 1) {
+                    clog(error) << "Error writing pseudo-terminal: " << strerror(errno) << std::endl;
+                    status = 1;
+                    break;
+                }
+                session.line_polls++;
+            } else {
+                clog(warning) << "Ignoring unexpected byte 0x" << std::hex
+                    << (int)value << std::dec << std::endl;
+            }
+        }
+    }
+
+    report(session);
+    if (vm.count("link"))
+        unlink(vm["link"].as<std::string>().c_str());
+    close(slave);
+    close(master);
+    return status;
+}
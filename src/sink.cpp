@@ -0,0 +1,107 @@
+//
+// Configuration
+//
+
+// Header
+#include "sink.hpp"
+
+// Standard library
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+// Local includes
+#include "auxiliary.hpp"
+#include "formatting.hpp"
+
+
+//
+// Archive sink
+//
+
+ArchiveSink::ArchiveSink(const std::string &filename)
+    : _filename(filename)
+{
+}
+
+void ArchiveSink::write(const Station::HistoryBatch &batch, const Statistics &)
+{
+    if (batch.empty())
+        return;
+    if (!_archive)
+        _archive.reset(new Archive(_filename, batch.external_sensors()));
+
+    size_t appended = _archive->append(batch);
+    clog(debug) << "Appended " << appended << " records to " << _filename
+        << ", which now holds " << _archive->size() << std::endl;
+}
+
+
+//
+// Format sink
+//
+
+FormatSink::FormatSink(const std::string &format, const std::string &label)
+    : _format(format), _prefix(label.empty() ? "" : label + ": ")
+{
+}
+
+void FormatSink::write(const Station::HistoryBatch &batch, const Statistics &)
+{
+    for (size_t i = 0; i < batch.size(); i++) {
+        Station::HistoryRecord record = batch.record(i);
+        clog(info) << _prefix << format_record(record.internal, record.datetime, "internal", 1, _format) << std::endl;
+        for (size_t s = 0; s < record.external.size(); s++)
+            clog(info) << _prefix << format_record(record.external[s], record.datetime, "external", s+1, _format) << std::endl;
+    }
+}
+
+
+//
+// Statistics sink
+//
+
+StatisticsSink::StatisticsSink(const std::string &filename, const std::string &device)
+    : _filename(filename), _device(device)
+{
+}
+
+void StatisticsSink::write(const Station::HistoryBatch &, const Statistics &statistics)
+{
+    write_statistics(_filename, statistics, _device);
+}
+
+
+//
+// Auxiliary
+//
+
+/**
+ * Write statistics in Prometheus text format, to a temporary file first so
+ * collectors never see a partially written file.
+ * @param filename File to replace.
+ * @param stats    Statistics to write.
+ * @param device   Device the statistics were gathered on.
+ */
+void write_statistics(const std::string &filename, const Statistics &stats,
+    const std::string &device)
+{
+    write_statistics(filename, std::vector<std::pair<std::string, Statistics>>(1,
+        std::make_pair(device, stats)));
+}
+
+/**
+ * Write the statistics of several devices in Prometheus text format.
+ * @param filename File to replace.
+ * @param devices  Devices, along with the statistics gathered on them.
+ */
+void write_statistics(const std::string &filename,
+    const std::vector<std::pair<std::string, Statistics>> &devices)
+{
+    const std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary.c_str());
+    file << prometheus(devices);
+    file.close();
+    if (!file || rename(temporary.c_str(), filename.c_str()) < 0)
+        throw std::runtime_error("Unable to write statistics to " + filename);
+}
@@ -0,0 +1,90 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_SINK_
+#define _OPENLACROSSE_SINK_
+
+// Standard library
+#include <string>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Local includes
+#include "station.hpp"
+#include "statistics.hpp"
+#include "archive.hpp"
+
+
+//
+// Module definitions
+//
+
+// Destination for the records collected from a station, along with the
+// statistics of its session
+class Sink
+{
+public:
+    // Construction and destruction
+    virtual ~Sink() { }
+
+    // Output
+    virtual void write(const Station::HistoryBatch &batch, const Statistics &statistics) = 0;
+};
+
+// Appends the records to an archive, which is opened once the first records
+// arrive, as only those tell the amount of sensors it has to hold
+class ArchiveSink : public Sink
+{
+public:
+    // Construction and destruction
+    ArchiveSink(const std::string &filename);
+
+    // Output
+    void write(const Station::HistoryBatch &batch, const Statistics &statistics);
+
+private:
+    std::string _filename;
+    std::unique_ptr<Archive> _archive;
+};
+
+// Logs every sensor reading of the records using a format string, prefixed
+// by a label if one is given
+class FormatSink : public Sink
+{
+public:
+    // Construction and destruction
+    FormatSink(const std::string &format, const std::string &label = "");
+
+    // Output
+    void write(const Station::HistoryBatch &batch, const Statistics &statistics);
+
+private:
+    std::string _format;
+    std::string _prefix;
+};
+
+// Replaces a file with the statistics of the station session
+class StatisticsSink : public Sink
+{
+public:
+    // Construction and destruction
+    StatisticsSink(const std::string &filename, const std::string &device);
+
+    // Output
+    void write(const Station::HistoryBatch &batch, const Statistics &statistics);
+
+private:
+    std::string _filename;
+    std::string _device;
+};
+
+// Auxiliary
+void write_statistics(const std::string &filename, const Statistics &stats,
+    const std::string &device);
+void write_statistics(const std::string &filename,
+    const std::vector<std::pair<std::string, Statistics>> &devices);
+
+#endif
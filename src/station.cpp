@@ -5,6 +5,130 @@
 // Header include
 #include "station.hpp"
 
+// Standard library
+#include <algorithm>
+
+// Boost
+#include <boost/optional/optional_io.hpp>
+
+
+//
+// History batches
+//
+
+Station::HistoryBatch::HistoryBatch(unsigned int external_sensors, size_t size)
+    : _external_sensors(external_sensors), _size(size), _datetime(size),
+      _temperature((external_sensors + 1) * size),
+      _humidity((external_sensors + 1) * size)
+{
+}
+
+boost::optional<double> Station::HistoryBatch::temperature(size_t index, unsigned int sensor) const
+{
+    int16_t value = _temperature[sensor * _size + index];
+    if (value == TEMPERATURE_UNAVAILABLE)
+        return boost::none;
+    return value / 10.0;
+}
+
+boost::optional<unsigned int> Station::HistoryBatch::humidity(size_t index, unsigned int sensor) const
+{
+    uint8_t value = _humidity[sensor * _size + index];
+    if (value == HUMIDITY_UNAVAILABLE)
+        return boost::none;
+    return (unsigned int)value;
+}
+
+/**
+ * Materialize a single record of the batch.
+ * @param index Index of the record.
+ * @return      Record.
+ */
+Station::HistoryRecord Station::HistoryBatch::record(size_t index) const
+{
+    SensorRecord internal(temperature(index, 0), humidity(index, 0));
+    std::vector<SensorRecord> external;
+    external.reserve(_external_sensors);
+    for (unsigned int s = 1; s <= _external_sensors; s++)
+        external.push_back(SensorRecord(temperature(index, s), humidity(index, s)));
+
+    HistoryRecord hr{datetime(index), internal, external};
+    return hr;
+}
+
+/**
+ * Copy a range of records into a new batch.
+ * @param begin Index of the first record.
+ * @param end   Index past the last record.
+ * @return      Records.
+ */
+Station::HistoryBatch Station::HistoryBatch::slice(size_t begin, size_t end) const
+{
+    end = std::min(end, _size);
+    begin = std::min(begin, end);
+
+    HistoryBatch batch(_external_sensors, end - begin);
+    std::copy(datetimes() + begin, datetimes() + end, batch.datetimes());
+    for (unsigned int s = 0; s <= _external_sensors; s++) {
+        std::copy(temperatures(s) + begin, temperatures(s) + end, batch.temperatures(s));
+        std::copy(humidities(s) + begin, humidities(s) + end, batch.humidities(s));
+    }
+    return batch;
+}
+
+
+//
+// History cursors
+//
+
+/**
+ * Prepare to read a range of records.
+ * @param station Station to read from.
+ * @param first   Number of the first record, which may exceed the amount of
+ *                slots when the history wraps around.
+ * @param count   Amount of records.
+ * @param chunk   Amount of records to read at once.
+ */
+Station::HistoryCursor::HistoryCursor(Station &station, unsigned int first,
+    unsigned int count, unsigned int chunk)
+    : _station(&station), _first(first), _count(count),
+      _chunk(std::max(chunk, 1u)), _position(0)
+{
+}
+
+/**
+ * Read the next chunk of records.
+ * @param batch Batch to replace with the records read.
+ * @return      Whether any records were left.
+ */
+bool Station::HistoryCursor::next(HistoryBatch &batch)
+{
+    if (_position == _count)
+        return false;
+
+    unsigned int count = std::min(_chunk, _count - _position);
+    batch = _station->history(_first + _position, count);
+    _position += count;
+    return true;
+}
+
+Station::HistoryCursor::iterator::iterator(HistoryCursor &cursor)
+    : _cursor(&cursor), _index(0)
+{
+    if (!_cursor->next(_batch))
+        _cursor = 0;
+}
+
+Station::HistoryCursor::iterator &Station::HistoryCursor::iterator::operator++()
+{
+    if (++_index == _batch.size()) {
+        _index = 0;
+        if (!_cursor->next(_batch))
+            _cursor = 0;
+    }
+    return *this;
+}
+
 
 //
 // Operators
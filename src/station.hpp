@@ -11,12 +11,23 @@
 #include <vector>
 #include <ostream>
 #include <ctime>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
 
 // Boost
 #include <boost/optional.hpp>
 
 // Local includes
 #include "global.hpp"
+#include "statistics.hpp"
+
+// Forward declarations
+class Mirror;
+
+// Values stored in history batches for readings which are not available
+const int16_t TEMPERATURE_UNAVAILABLE = INT16_MIN;
+const uint8_t HUMIDITY_UNAVAILABLE = 0xFF;
 
 // TODO's
 // - Don't use an abstract superclass, but provide stubs which throw an
@@ -30,7 +41,7 @@
 // Module definitions
 //
 
-class ProtocolException : std::runtime_error
+class ProtocolException : public std::runtime_error
 {
 public:
     ProtocolException(const std::string& message)
@@ -56,22 +67,144 @@ public:
         std::vector<SensorRecord> external;
     };
 
+    // Consecutive history records, stored column by column: timestamps,
+    // temperatures in tenths of degrees and humidities as percentage, with
+    // unavailable readings stored as sentinel values
+    class HistoryBatch
+    {
+    public:
+        // View on a single record of the batch
+        class View
+        {
+        public:
+            View(const HistoryBatch &batch, size_t index)
+                : _batch(&batch), _index(index) { }
+
+            time_t datetime() const { return _batch->datetime(_index); }
+            boost::optional<double> temperature(unsigned int sensor) const
+                { return _batch->temperature(_index, sensor); }
+            boost::optional<unsigned int> humidity(unsigned int sensor) const
+                { return _batch->humidity(_index, sensor); }
+            operator HistoryRecord() const { return _batch->record(_index); }
+
+        private:
+            const HistoryBatch *_batch;
+            size_t _index;
+        };
+
+        // Construction and destruction
+        HistoryBatch(unsigned int external_sensors = 0, size_t size = 0);
+
+        // Properties
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        unsigned int external_sensors() const { return _external_sensors; }
+
+        // Record access
+        time_t datetime(size_t index) const { return _datetime[index]; }
+        boost::optional<double> temperature(size_t index, unsigned int sensor) const;
+        boost::optional<unsigned int> humidity(size_t index, unsigned int sensor) const;
+        HistoryRecord record(size_t index) const;
+        View operator[](size_t index) const { return View(*this, index); }
+
+        // Column access
+        time_t *datetimes() { return _datetime.data(); }
+        const time_t *datetimes() const { return _datetime.data(); }
+        int16_t *temperatures(unsigned int sensor) { return _temperature.data() + sensor * _size; }
+        const int16_t *temperatures(unsigned int sensor) const { return _temperature.data() + sensor * _size; }
+        uint8_t *humidities(unsigned int sensor) { return _humidity.data() + sensor * _size; }
+        const uint8_t *humidities(unsigned int sensor) const { return _humidity.data() + sensor * _size; }
+
+        // Manipulation
+        HistoryBatch slice(size_t begin, size_t end) const;
+
+    private:
+        unsigned int _external_sensors;
+        size_t _size;
+        std::vector<time_t> _datetime;
+        std::vector<int16_t> _temperature;
+        std::vector<uint8_t> _humidity;
+    };
+
+    // Consecutive history records, read from the station a chunk at a time
+    // while being traversed
+    class HistoryCursor
+    {
+    public:
+        // Input iterator over the records, yielding views which remain valid
+        // until the iterator is advanced
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            typedef HistoryBatch::View value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const HistoryBatch::View *pointer;
+            typedef HistoryBatch::View reference;
+
+            iterator() : _cursor(0), _index(0) { }
+            iterator(HistoryCursor &cursor);
+
+            HistoryBatch::View operator*() const { return _batch[_index]; }
+            iterator &operator++();
+            bool operator==(const iterator &other) const { return _cursor == other._cursor; }
+            bool operator!=(const iterator &other) const { return _cursor != other._cursor; }
+
+        private:
+            HistoryCursor *_cursor;
+            HistoryBatch _batch;
+            size_t _index;
+        };
+
+        // Construction and destruction
+        HistoryCursor(Station &station, unsigned int first, unsigned int count,
+            unsigned int chunk);
+
+        // Properties
+        unsigned int size() const { return _count; }
+        unsigned int remaining() const { return _count - _position; }
+
+        // Traversal
+        bool next(HistoryBatch &batch);
+        iterator begin() { return iterator(*this); }
+        iterator end() { return iterator(); }
+
+    private:
+        Station *_station;
+        unsigned int _first;
+        unsigned int _count;
+        unsigned int _chunk;
+        unsigned int _position;
+    };
+
     // Construction and destruction
     virtual ~Station() { }
 
+    // Session management
+    virtual void connect() = 0;
+    virtual bool responsive() = 0;
+
     // Station properties
     virtual unsigned int external_sensors() = 0;
 
     // History management
     virtual HistoryRecord history(unsigned int record_no) = 0;
+    virtual HistoryBatch history(unsigned int first, unsigned int count) = 0;
     virtual int history_count() = 0;
     virtual time_t history_modtime() = 0;
     virtual HistoryRecord history_first() = 0;
     virtual HistoryRecord history_last() = 0;
+    virtual HistoryBatch history_since(time_t datetime) = 0;
+    virtual HistoryBatch history_range(time_t from, time_t to) = 0;
+    virtual HistoryCursor history_cursor(time_t from, time_t to) = 0;
     virtual bool history_reset() = 0;
 
     // Other
     virtual std::vector<byte> memory_dump() = 0;
+    virtual void snapshot() = 0;
+    virtual void drop_snapshot() = 0;
+    virtual void sync(Mirror &mirror) = 0;
+    virtual const Statistics &statistics() = 0;
 };
 
 // Operators
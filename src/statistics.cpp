@@ -0,0 +1,243 @@
+//
+// Configuration
+//
+
+// Header
+#include "statistics.hpp"
+
+// Standard library
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+
+//
+// Construction and destruction
+//
+
+Statistics::Statistics()
+    : ioctls(0), bits_read(0), bits_written(0), delays(0), delay_ns(0),
+      delay_requested_ns(0), delay_max_ns(0), bit_latency_ns(0),
+      realtime_transactions(0),
+      read_retries(0), read_mismatches(0),
+      repair_reads(0), repaired_bytes(0), zero_rejections(0),
+      validations(0), validation_failures(0),
+      checkpoints(0), checkpoint_mismatches(0), handshake_waits(0),
+      handshake_raise_ns(0), handshake_clear_ns(0),
+      handshakes(0), session_checks(0), session_drops(0),
+      tune_mismatches(0)
+{
+    memset(bit_latency, 0, sizeof(bit_latency));
+}
+
+
+//
+// Latency histogram
+//
+
+/**
+ * Get the exclusive upper bound of a latency bucket.
+ * @param bucket Bucket, the last of which is unbounded.
+ * @return       Bound in nanoseconds, or 0 for the last bucket.
+ */
+uint64_t Statistics::latency_bound(unsigned int bucket)
+{
+    return (bucket + 1 < LATENCY_BUCKETS) ? 1024ULL << bucket : 0;
+}
+
+/**
+ * Count the time it took to clock in a bit.
+ * @param ns Time since the previous bit was sampled, or since the transfer
+ *           started for its first bit.
+ */
+void Statistics::record_bit_latency(uint64_t ns)
+{
+    unsigned int bucket = 0;
+    while (bucket + 1 < LATENCY_BUCKETS && ns >= latency_bound(bucket))
+        bucket++;
+    bit_latency[bucket]++;
+    bit_latency_ns += ns;
+}
+
+
+//
+// Reporting
+//
+
+std::ostream & operator<<(std::ostream &os, const Statistics &stats)
+{
+    os << "Bus statistics:" << std::endl
+       << "  ioctls issued:           " << stats.ioctls << std::endl
+       << "  bytes read:              " << stats.bits_read / 8
+            << " (" << stats.bits_read << " bits)" << std::endl
+       << "  bytes written:           " << stats.bits_written / 8
+            << " (" << stats.bits_written << " bits)" << std::endl
+       << "  time spent in delays:    " << stats.delay_ns / 1e9 << " s"
+            << " (" << stats.delays << " delays)" << std::endl;
+    if (stats.delays > 0)
+        os << "  edge timing:             "
+                << stats.delay_ns / stats.delays << " ns achieved, "
+                << stats.delay_requested_ns / stats.delays << " ns requested"
+                << " (at most " << stats.delay_max_ns << " ns)" << std::endl;
+    if (stats.bits_read > 0) {
+        os << "  bit latency:             "
+                << stats.bit_latency_ns / stats.bits_read << " ns on average" << std::endl;
+        for (unsigned int i = 0; i < Statistics::LATENCY_BUCKETS; i++) {
+            if (stats.bit_latency[i] == 0)
+                continue;
+            os << "    ";
+            if (Statistics::latency_bound(i))
+                os << "< " << std::setw(8) << Statistics::latency_bound(i) / 1000.0 << " µs: ";
+            else
+                os << ">=" << std::setw(8) << Statistics::latency_bound(i - 1) / 1000.0 << " µs: ";
+            os << stats.bit_latency[i] << std::endl;
+        }
+    }
+    if (stats.realtime_transactions > 0)
+        os << "  real-time transactions:  " << stats.realtime_transactions << std::endl;
+    os << "Station statistics:" << std::endl
+       << "  read retries:            " << stats.read_retries << std::endl
+       << "  double-read mismatches:  " << stats.read_mismatches << std::endl
+       << "  sub-range repair reads:  " << stats.repair_reads
+            << " (" << stats.repaired_bytes << " bytes resolved)" << std::endl
+       << "  all-zero rejections:     " << stats.zero_rejections << std::endl
+       << "  semantic validations:    " << stats.validations
+            << " (" << stats.validation_failures << " failed)" << std::endl
+       << "  bulk read checkpoints:   " << stats.checkpoints
+            << " (" << stats.checkpoint_mismatches << " failed)" << std::endl
+       << "  handshake wait polls:    " << stats.handshake_waits << std::endl
+       << "  handshakes:              " << stats.handshakes << std::endl
+       << "  handshake DSR waits:     " << stats.handshake_raise_ns / 1e9
+            << " s raising, " << stats.handshake_clear_ns / 1e9 << " s clearing" << std::endl
+       << "  session checks:          " << stats.session_checks
+            << " (" << stats.session_drops << " dropped)" << std::endl;
+    if (stats.tune_mismatches > 0)
+        os << "  tuning mismatches:       " << stats.tune_mismatches << std::endl;
+    return os;
+}
+
+// Counters exposed in the Prometheus text format
+struct Counter
+{
+    const char *name;
+    const char *help;
+    double (*value)(const Statistics &s);
+};
+static const Counter COUNTERS[] = {
+    {"ioctls", "Modem line ioctls issued.",
+        [](const Statistics &s) -> double { return s.ioctls; }},
+    {"bits_read", "Bits read from the station.",
+        [](const Statistics &s) -> double { return s.bits_read; }},
+    {"bits_written", "Bits written to the station.",
+        [](const Statistics &s) -> double { return s.bits_written; }},
+    {"bytes_read", "Bytes read from the station.",
+        [](const Statistics &s) -> double { return s.bits_read / 8; }},
+    {"bytes_written", "Bytes written to the station.",
+        [](const Statistics &s) -> double { return s.bits_written / 8; }},
+    {"delay_seconds", "Time spent waiting for the lines to settle.",
+        [](const Statistics &s) -> double { return s.delay_ns / 1e9; }},
+    {"delay_requested_seconds", "Time requested to wait for the lines to settle.",
+        [](const Statistics &s) -> double { return s.delay_requested_ns / 1e9; }},
+    {"realtime_transactions", "Transactions performed with real-time priority.",
+        [](const Statistics &s) -> double { return s.realtime_transactions; }},
+    {"read_retries", "Safe reads which had to be retried.",
+        [](const Statistics &s) -> double { return s.read_retries; }},
+    {"read_mismatches", "Double reads which returned different data.",
+        [](const Statistics &s) -> double { return s.read_mismatches; }},
+    {"repair_reads", "Re-reads of bytes on which double reads disagreed.",
+        [](const Statistics &s) -> double { return s.repair_reads; }},
+    {"repaired_bytes", "Bytes resolved by majority vote.",
+        [](const Statistics &s) -> double { return s.repaired_bytes; }},
+    {"zero_rejections", "Reads rejected for only containing zeroes.",
+        [](const Statistics &s) -> double { return s.zero_rejections; }},
+    {"validations", "Single reads checked against the memory layout.",
+        [](const Statistics &s) -> double { return s.validations; }},
+    {"validation_failures", "Single reads which did not fit the memory layout.",
+        [](const Statistics &s) -> double { return s.validation_failures; }},
+    {"checkpoints", "Bulk read checkpoints verified.",
+        [](const Statistics &s) -> double { return s.checkpoints; }},
+    {"checkpoint_mismatches", "Bulk read checkpoints which failed.",
+        [](const Statistics &s) -> double { return s.checkpoint_mismatches; }},
+    {"handshake_waits", "Polls of the DSR line during the handshake.",
+        [](const Statistics &s) -> double { return s.handshake_waits; }},
+    {"handshake_raise_seconds", "Time the station took to raise DSR during handshakes.",
+        [](const Statistics &s) -> double { return s.handshake_raise_ns / 1e9; }},
+    {"handshake_clear_seconds", "Time the station took to clear DSR during handshakes.",
+        [](const Statistics &s) -> double { return s.handshake_clear_ns / 1e9; }},
+    {"handshakes", "Handshakes performed to open a session.",
+        [](const Statistics &s) -> double { return s.handshakes; }},
+    {"session_checks", "Checks whether the session was still open.",
+        [](const Statistics &s) -> double { return s.session_checks; }},
+    {"session_drops", "Checks which found the session dropped.",
+        [](const Statistics &s) -> double { return s.session_drops; }},
+    {"tune_mismatches", "Double reads which failed while tuning the bus timing.",
+        [](const Statistics &s) -> double { return s.tune_mismatches; }},
+};
+
+static std::string labels(const std::string &device, const std::string &extra = "")
+{
+    std::string escaped;
+    for (size_t i = 0; i < device.size(); i++) {
+        if (device[i] == '\\' || device[i] == '"')
+            escaped += '\\';
+        escaped += device[i];
+    }
+    return "{device=\"" + escaped + "\"" + extra + "}";
+}
+
+/**
+ * Render the statistics in the Prometheus text format.
+ * @param stats  Statistics to render.
+ * @param device Device the statistics were gathered on, used as label.
+ * @return       Metrics exposition.
+ */
+std::string prometheus(const Statistics &stats, const std::string &device)
+{
+    return prometheus(std::vector<std::pair<std::string, Statistics>>(1,
+        std::make_pair(device, stats)));
+}
+
+/**
+ * Render the statistics of several devices in the Prometheus text format.
+ * @param devices Devices, along with the statistics gathered on them.
+ * @return        Metrics exposition.
+ */
+std::string prometheus(const std::vector<std::pair<std::string, Statistics>> &devices)
+{
+    std::ostringstream os;
+    os.precision(12);
+    for (size_t c = 0; c < sizeof(COUNTERS) / sizeof(COUNTERS[0]); c++) {
+        const Counter &counter = COUNTERS[c];
+        // Version 0.0.4 of the format, which the node_exporter textfile
+        // collector parses, types the samples by their full name
+        os << "# TYPE lacrosse_" << counter.name << "_total counter" << std::endl
+           << "# HELP lacrosse_" << counter.name << "_total " << counter.help << std::endl;
+        for (size_t d = 0; d < devices.size(); d++)
+            os << "lacrosse_" << counter.name << "_total" << labels(devices[d].first)
+               << " " << counter.value(devices[d].second) << std::endl;
+    }
+
+    os << "# TYPE lacrosse_bit_latency_seconds histogram" << std::endl
+       << "# HELP lacrosse_bit_latency_seconds Time it took to clock in each bit read." << std::endl;
+    for (size_t d = 0; d < devices.size(); d++) {
+        const Statistics &stats = devices[d].second;
+        uint64_t cumulative = 0;
+        for (unsigned int i = 0; i < Statistics::LATENCY_BUCKETS; i++) {
+            cumulative += stats.bit_latency[i];
+            std::ostringstream bound;
+            bound.precision(12);
+            if (Statistics::latency_bound(i))
+                bound << Statistics::latency_bound(i) / 1e9;
+            else
+                bound << "+Inf";
+            os << "lacrosse_bit_latency_seconds_bucket"
+               << labels(devices[d].first, ",le=\"" + bound.str() + "\"")
+               << " " << cumulative << std::endl;
+        }
+        os << "lacrosse_bit_latency_seconds_count" << labels(devices[d].first)
+           << " " << cumulative << std::endl
+           << "lacrosse_bit_latency_seconds_sum" << labels(devices[d].first)
+           << " " << stats.bit_latency_ns / 1e9 << std::endl;
+    }
+    return os.str();
+}
@@ -0,0 +1,67 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_STATISTICS_
+#define _OPENLACROSSE_STATISTICS_
+
+// Standard library
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+//
+// Module definitions
+//
+
+// Counters describing the traffic of a station session
+struct Statistics
+{
+    Statistics();
+
+    // Latency histogram, with buckets doubling from one microsecond
+    static const unsigned int LATENCY_BUCKETS = 16;
+    static uint64_t latency_bound(unsigned int bucket);
+    void record_bit_latency(uint64_t ns);
+
+    // Bus
+    uint64_t ioctls;
+    uint64_t bits_read;
+    uint64_t bits_written;
+    uint64_t delays;
+    uint64_t delay_ns;
+    uint64_t delay_requested_ns;
+    uint64_t delay_max_ns;
+    uint64_t bit_latency[LATENCY_BUCKETS];
+    uint64_t bit_latency_ns;
+    uint64_t realtime_transactions;
+
+    // Station
+    uint64_t read_retries;
+    uint64_t read_mismatches;
+    uint64_t repair_reads;
+    uint64_t repaired_bytes;
+    uint64_t zero_rejections;
+    uint64_t validations;
+    uint64_t validation_failures;
+    uint64_t checkpoints;
+    uint64_t checkpoint_mismatches;
+    uint64_t handshake_waits;
+    uint64_t handshake_raise_ns;
+    uint64_t handshake_clear_ns;
+    uint64_t handshakes;
+    uint64_t session_checks;
+    uint64_t session_drops;
+    uint64_t tune_mismatches;
+};
+
+// Reporting
+std::ostream & operator<<(std::ostream &os, const Statistics &stats);
+std::string prometheus(const Statistics &stats, const std::string &device);
+std::string prometheus(const std::vector<std::pair<std::string, Statistics>> &devices);
+
+#endif
@@ -0,0 +1,146 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_TASK_
+#define _OPENLACROSSE_TASK_
+
+// This header requires C++20
+#if __cplusplus < 202002L
+#error "task.hpp requires C++20 coroutines"
+#endif
+
+// Standard library
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+
+//
+// Module definitions
+//
+
+// Lazily started coroutine producing a value. Awaiting a task starts it, and
+// resumes the awaiting coroutine once it completes, without growing the
+// stack.
+template <typename T>
+class Task;
+
+namespace TaskDetail
+{
+    // Parts of the promise shared by all result types
+    struct PromiseBase
+    {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept { }
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase
+    {
+        std::optional<T> value;
+
+        Task<T> get_return_object();
+        void return_value(T result) { value = std::move(result); }
+        T result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase
+    {
+        Task<void> get_return_object();
+        void return_void() { }
+        void result()
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+    };
+}
+
+template <typename T = void>
+class Task
+{
+public:
+    // Subclasses
+    typedef TaskDetail::Promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    // Construction and destruction
+    explicit Task(handle_type handle = handle_type()) : _handle(handle) { }
+    Task(Task &&other) noexcept : _handle(std::exchange(other._handle, handle_type())) { }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other) {
+            if (_handle)
+                _handle.destroy();
+            _handle = std::exchange(other._handle, handle_type());
+        }
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task()
+    {
+        if (_handle)
+            _handle.destroy();
+    }
+
+    // Properties
+    bool done() const { return !_handle || _handle.done(); }
+    handle_type handle() const { return _handle; }
+
+    // Awaiting
+    bool await_ready() const noexcept { return !_handle || _handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        _handle.promise().continuation = awaiting;
+        return _handle;
+    }
+    T await_resume() { return _handle.promise().result(); }
+
+    // Retrieve the result of a completed task
+    T result() { return _handle.promise().result(); }
+
+private:
+    handle_type _handle;
+};
+
+namespace TaskDetail
+{
+    template <typename T>
+    Task<T> Promise<T>::get_return_object()
+    {
+        return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+    }
+
+    inline Task<void> Promise<void>::get_return_object()
+    {
+        return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+    }
+}
+
+#endif
@@ -0,0 +1,290 @@
+//
+// Configuration
+//
+
+// Header
+#include "termiosdriver.hpp"
+
+// Standard library
+#include <cstring>
+#include <cassert>
+
+// Platform
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <time.h>
+
+// Older C libraries lack the name of the thread ID field
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Configurable values
+#define WAIT_REPEAT 10  // ms between repeats of the signal interrupting a
+                        // wait, in case it arrived before the wait started
+
+
+//
+// Auxiliary
+//
+
+// Only there to interrupt TIOCMIWAIT, which is why it is installed without
+// SA_RESTART
+static void interrupt_wait(int)
+{
+}
+
+// Install the handler interrupting waits, once per process. A handler which
+// was installed before is kept, and can serve as long as it doesn't restart
+// the wait.
+static bool install_wait_handler()
+{
+    static const bool usable = []() -> bool {
+        struct sigaction previous;
+        if (sigaction(WAIT_SIGNAL, 0, &previous) < 0)
+            return false;
+        if (previous.sa_flags & SA_SIGINFO)
+            return !(previous.sa_flags & SA_RESTART);
+        if (previous.sa_handler == SIG_IGN)
+            return false;
+        if (previous.sa_handler != SIG_DFL)
+            return !(previous.sa_flags & SA_RESTART);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = interrupt_wait;
+        sigemptyset(&action.sa_mask);
+        return sigaction(WAIT_SIGNAL, &action, 0) == 0;
+    }();
+    return usable;
+}
+
+
+//
+// Construction and destruction
+//
+
+TermiosDriver::TermiosDriver(const std::string& portname)
+{
+    // Open the port
+    //clog(info) << "open_weatherstation" << std::endl;
+    if ((_sp = open(portname.c_str(), O_RDWR | O_NOCTTY)) < 0)
+        throw HardwareException("Unable to open serial device");
+    if ( flock(_sp, LOCK_EX) < 0 )
+        throw HardwareException("Serial device is locked by other program");
+
+    // We want full control of what is set by simply resetting entire adtio
+    // struct    
+    struct termios adtio;
+    memset(&adtio, 0, sizeof(adtio));
+
+    // Serial control options
+    adtio.c_cflag &= ~PARENB;      // No parity
+    adtio.c_cflag &= ~CSTOPB;      // One stop bit
+    adtio.c_cflag &= ~CSIZE;       // Character size mask
+    adtio.c_cflag |= CS8;          // Character size 8 bits
+    adtio.c_cflag |= CREAD;        // Enable Receiver
+    //adtio.c_cflag &= ~CREAD;        // Disable Receiver
+    adtio.c_cflag &= ~HUPCL;       // No "hangup"
+    adtio.c_cflag &= ~CRTSCTS;     // No flowcontrol
+    adtio.c_cflag |= CLOCAL;       // Ignore modem control lines
+
+    // Baudrate, for newer systems
+    cfsetispeed(&adtio, BAUDRATE);
+    cfsetospeed(&adtio, BAUDRATE);
+
+    // Local options
+    //   Raw input = clear ICANON, ECHO, ECHOE, and ISIG
+    //   Disable misc other local features = clear FLUSHO, NOFLSH, TOSTOP, PENDIN, and IEXTEN
+    // So we actually clear all flags in adtio.c_lflag
+    adtio.c_lflag = 0;
+
+    // Input options
+    //   Disable parity check = clear INPCK, PARMRK, and ISTRIP
+    //   Disable software flow control = clear IXON, IXOFF, and IXANY
+    //   Disable any translation of CR and LF = clear INLCR, IGNCR, and ICRNL
+    //   Ignore break condition on input = set IGNBRK
+    //   Ignore parity errors just in case = set IGNPAR;
+    // So we can clear all flags except IGNBRK and IGNPAR
+    adtio.c_iflag = IGNBRK|IGNPAR;
+
+    // Output options
+    // Raw output should disable all other output options
+    adtio.c_oflag &= ~OPOST;
+
+    // Time-out options
+    adtio.c_cc[VTIME] = 10;     // timer 1s
+    adtio.c_cc[VMIN] = 0;       // blocking read until 1 char
+
+    if (tcsetattr(_sp, TCSANOW, &adtio) < 0)
+        throw HardwareException("Unable to initialize serial device");
+    tcflush(_sp, TCIOFLUSH);
+
+    // Remember the state of the other output lines, as TIOCMSET sets them
+    // all at once. Pseudo-terminals don't have modem lines, in which case
+    // we tunnel them over the byte stream (see lacrosse-sim).
+    _inband = false;
+    if (ioctl(_sp, TIOCMGET, &_portstatus) < 0) {
+        if (errno != ENOTTY)
+            throw HardwareException("Unable to read modem lines");
+        _inband = true;
+        _portstatus = 0;
+    }
+
+    _miwait = !_inband && install_wait_handler();
+}
+
+TermiosDriver::~TermiosDriver()
+{
+    tcflush(_sp, TCIOFLUSH);
+    close(_sp);
+}
+
+
+//
+// Modem lines
+//
+
+/**
+ * Set the output modem lines.
+ * @param lines Mask of output lines to raise, all others are cleared.
+ */
+void TermiosDriver::set_lines(int lines)
+{
+    if (_inband) {
+        byte request = (byte)(INBAND_SET | (lines & Line::OUTPUTS));
+        if (write(_sp, &request, 1) != 1)
+            throw HardwareException("Unable to set modem lines");
+        return;
+    }
+
+    _portstatus &= ~(TIOCM_DTR | TIOCM_RTS);
+    if (lines & Line::DTR)
+        _portstatus |= TIOCM_DTR;
+    if (lines & Line::RTS)
+        _portstatus |= TIOCM_RTS;
+    ioctl(_sp, TIOCMSET, &_portstatus);
+}
+
+/**
+ * Get the status of the modem lines.
+ * @return Mask of lines which are raised.
+ */
+int TermiosDriver::get_lines()
+{
+    if (_inband) {
+        byte request = INBAND_GET, reply;
+        if (write(_sp, &request, 1) != 1)
+            throw HardwareException("Unable to get modem lines");
+        do {
+            if (read(_sp, &reply, 1) != 1)
+                throw HardwareException("No modem line status received");
+        } while ((reply & 0xF0) != INBAND_STATUS);
+        return reply & 0x0F;
+    }
+
+    int portstatus;
+    ioctl(_sp, TIOCMGET, &portstatus);   // get current port status
+
+    int lines = 0;
+    if (portstatus & TIOCM_DTR)
+        lines |= Line::DTR;
+    if (portstatus & TIOCM_RTS)
+        lines |= Line::RTS;
+    if (portstatus & TIOCM_CTS)
+        lines |= Line::CTS;
+    if (portstatus & TIOCM_DSR)
+        lines |= Line::DSR;
+    return lines;
+}
+
+/**
+ * Block until one of the input modem lines changes, using TIOCMIWAIT. As
+ * that has no timeout of its own, a timer signals the calling thread at the
+ * deadline, interrupting the wait. The signal repeats until the wait
+ * returned, as the first one may arrive before the wait even started.
+ * @param mask       Mask of input lines to watch.
+ * @param timeout_ms Maximal time to wait.
+ * @return           Whether the driver could wait for changes, which is not
+ *                   the case for pseudo-terminals and serial drivers lacking
+ *                   TIOCMIWAIT.
+ */
+bool TermiosDriver::wait_lines(int mask, unsigned int timeout_ms)
+{
+    if (!_miwait)
+        return false;
+    if (timeout_ms == 0)
+        return true;
+
+    int events = 0;
+    if (mask & Line::CTS)
+        events |= TIOCM_CTS;
+    if (mask & Line::DSR)
+        events |= TIOCM_DSR;
+
+    struct sigevent notification;
+    memset(&notification, 0, sizeof(notification));
+    notification.sigev_notify = SIGEV_THREAD_ID;
+    notification.sigev_signo = WAIT_SIGNAL;
+    notification.sigev_notify_thread_id = syscall(SYS_gettid);
+    timer_t timer;
+    if (timer_create(CLOCK_MONOTONIC, &notification, &timer) < 0) {
+        _miwait = false;
+        return false;
+    }
+    struct itimerspec expiry;
+    memset(&expiry, 0, sizeof(expiry));
+    expiry.it_value.tv_sec = timeout_ms / 1000;
+    expiry.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    expiry.it_interval.tv_nsec = WAIT_REPEAT * 1000000L;
+    timer_settime(timer, 0, &expiry, 0);
+
+    int result = ioctl(_sp, TIOCMIWAIT, events);
+    int error = errno;
+    timer_delete(timer);
+
+    if (result < 0 && error != EINTR) {
+        _miwait = false;
+        return false;
+    }
+    return true;
+}
+
+
+//
+// Byte stream
+//
+
+/**
+ * Read data from the serial line in the usual manner.
+ * @param  length Number of bytes to read.
+ * @return        Data read..
+ */
+std::vector<byte> TermiosDriver::read_device(size_t length)
+{
+    std::vector<byte> data(length);
+    size_t ret;
+
+    for (;;) {
+        ret = read(_sp, data.data(), length);
+        if (ret == 0 && errno == EINTR)
+            continue;
+        assert(ret == length);
+        return data;
+    }
+}
+
+/**
+ * Write data over the serial line in the usual manner.
+ * @param  data   Data to send.
+ */
+void TermiosDriver::write_device(const std::vector<byte> &data)
+{
+    size_t ret = write(_sp, data.data(), data.size());
+    assert(ret == data.size());
+}
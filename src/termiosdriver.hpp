@@ -0,0 +1,65 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_TERMIOSDRIVER_
+#define _OPENLACROSSE_TERMIOSDRIVER_
+
+// Standard library
+#include <string>
+#include <vector>
+
+// Local includes
+#include "global.hpp"
+#include "linedriver.hpp"
+
+// Configurable values
+#define BAUDRATE B300
+
+// In-band modem line protocol, for pseudo-terminals. The low nibble of each
+// message carries the Line mask.
+#define INBAND_SET 0xF0
+#define INBAND_GET 0xE0
+#define INBAND_STATUS 0xD0
+
+// Signal interrupting a wait for modem line changes at its deadline
+#define WAIT_SIGNAL SIGRTMIN
+
+
+//
+// Module definitions
+//
+
+// Line driver for a serial port accessed through termios
+class TermiosDriver : public LineDriver
+{
+public:
+    // Construction and destruction
+    TermiosDriver(const std::string& portname);
+    ~TermiosDriver();
+
+    // Modem lines
+    void set_lines(int lines);
+    int get_lines();
+    bool wait_lines(int mask, unsigned int timeout_ms);
+
+    // Byte stream
+    std::vector<byte> read_device(size_t length);
+    void write_device(const std::vector<byte> &data);
+
+private:
+    // Serial port filehandle
+    int _sp;
+
+    // Last modem status written to the port
+    int _portstatus;
+
+    // Whether the modem lines are tunneled over the byte stream
+    bool _inband;
+
+    // Whether the serial driver supports waiting for modem line changes
+    bool _miwait;
+};
+
+#endif
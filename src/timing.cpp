@@ -0,0 +1,195 @@
+//
+// Configuration
+//
+
+// Header
+#include "timing.hpp"
+
+// Standard library
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+
+// Platform
+#include <sys/prctl.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+// Local includes
+#include "auxiliary.hpp"
+
+// Configurable values
+#define TIMER_SLACK 1               // ns the kernel may defer our wakeups by
+#define CALIBRATION_PERIOD 10000000 // ns to measure the time stamp counter for
+#define CALIBRATION_READS 1000      // clock reads to average the cost over
+#define CALIBRATION_SLEEPS 16       // sleeps to measure the wakeup latency with
+#define CALIBRATION_SLEEP 20000     // ns to sleep for during calibration
+#define MAX_SLEEP_MARGIN 2000000    // ns to busy-wait at most before a deadline
+
+
+//
+// Timer slack
+//
+
+// The timer slack is a property of each thread, rather than of the process,
+// so reduce it once in every thread which sleeps through the engine
+static void reduce_timer_slack()
+{
+    static thread_local bool reduced = false;
+    if (!reduced) {
+        // Don't let the kernel coalesce our wakeups with others
+        prctl(PR_SET_TIMERSLACK, TIMER_SLACK, 0, 0, 0);
+        reduced = true;
+    }
+}
+
+
+//
+// Construction and destruction
+//
+
+/**
+ * Access the timing engine, calibrating it on the first access. Serial
+ * interfaces access it when constructed, so that calibration happens at
+ * startup rather than in the middle of a transaction.
+ * @return The timing engine.
+ */
+Timing &Timing::instance()
+{
+    static Timing timing;
+    return timing;
+}
+
+Timing::Timing()
+    : _tsc(false), _ticks_per_ns(0), _clock_cost(0), _sleep_margin(0)
+{
+    reduce_timer_slack();
+
+    calibrate_clock();
+    calibrate_tsc();
+    calibrate_sleep();
+
+    clog(debug) << "Timing calibrated: "
+        << (_tsc ? "time stamp counter" : "monotonic clock") << " busy-wait";
+    if (_tsc)
+        clog(debug) << " at " << _ticks_per_ns << " GHz";
+    clog(debug) << ", " << _clock_cost << " ns per clock read, "
+        << _sleep_margin / 1000.0 << " µs wakeup latency" << std::endl;
+}
+
+
+//
+// Waiting
+//
+
+/**
+ * Wait for an amount of time, sleeping when the wait is long enough for
+ * the wakeup latency not to matter.
+ * @param ns Time to wait, in nanoseconds.
+ * @return   Time actually waited, in nanoseconds.
+ */
+uint64_t Timing::wait(uint64_t ns)
+{
+    if (ns <= _sleep_margin)
+        return spin(ns);
+
+    reduce_timer_slack();
+    uint64_t start = monotonic_ns();
+    uint64_t deadline = start + ns;
+    uint64_t wakeup = deadline - _sleep_margin;
+    struct timespec until;
+    until.tv_sec = wakeup / 1000000000ULL;
+    until.tv_nsec = wakeup % 1000000000ULL;
+    // Only resume sleeping after a signal, any other failure is left to the
+    // busy-wait below
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0) == EINTR)
+        ;
+
+    uint64_t now = monotonic_ns();
+    if (now < deadline)
+        spin(deadline - now);
+    return monotonic_ns() - start;
+}
+
+
+//
+// Calibration
+//
+
+// Measure the cost of reading the monotonic clock
+void Timing::calibrate_clock()
+{
+    uint64_t start = monotonic_ns();
+    for (unsigned int i = 0; i < CALIBRATION_READS; i++)
+        monotonic_ns();
+    _clock_cost = (monotonic_ns() - start) / CALIBRATION_READS;
+}
+
+// Measure the rate of the time stamp counter against the monotonic clock,
+// if it runs at a constant rate across frequency changes and sleep states
+void Timing::calibrate_tsc()
+{
+#ifdef HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+        return;
+
+    uint64_t start = monotonic_ns(), end;
+    uint64_t ticks = __rdtsc();
+    do {
+        end = monotonic_ns();
+    } while (end - start < CALIBRATION_PERIOD);
+    ticks = __rdtsc() - ticks;
+
+    _ticks_per_ns = (double) ticks / (end - start);
+    _tsc = _ticks_per_ns > 0;
+#endif
+}
+
+// Measure how late the kernel wakes us up, which is how long before a
+// deadline sleeping has to stop
+void Timing::calibrate_sleep()
+{
+    uint64_t latency = 0;
+    for (unsigned int i = 0; i < CALIBRATION_SLEEPS; i++) {
+        struct timespec duration;
+        duration.tv_sec = 0;
+        duration.tv_nsec = CALIBRATION_SLEEP;
+        uint64_t start = monotonic_ns();
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &duration, 0);
+        uint64_t slept = monotonic_ns() - start;
+        if (slept > CALIBRATION_SLEEP)
+            latency = std::max(latency, slept - CALIBRATION_SLEEP);
+    }
+    _sleep_margin = std::min<uint64_t>(latency + _clock_cost, MAX_SLEEP_MARGIN);
+}
+
+
+//
+// Auxiliary
+//
+
+// Busy-wait, returning the time actually waited
+uint64_t Timing::spin(uint64_t ns)
+{
+#ifdef HAVE_TSC
+    if (_tsc) {
+        uint64_t ticks = (uint64_t) (ns * _ticks_per_ns);
+        uint64_t start = __rdtsc(), elapsed;
+        do {
+            _mm_pause();
+            elapsed = __rdtsc() - start;
+        } while (elapsed < ticks);
+        return (uint64_t) (elapsed / _ticks_per_ns);
+    }
+#endif
+
+    uint64_t start = monotonic_ns(), elapsed;
+    do {
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < ns);
+    return elapsed;
+}
@@ -0,0 +1,58 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_TIMING_
+#define _OPENLACROSSE_TIMING_
+
+// Standard library
+#include <cstdint>
+
+
+//
+// Module definitions
+//
+
+// Waits for short, precise amounts of time. Sleeping is only accurate to the
+// scheduler latency, which is an order of magnitude above the delays the bus
+// needs, so short waits busy-wait on the time stamp counter or the monotonic
+// clock instead. Longer waits sleep until shortly before the deadline, and
+// busy-wait the remainder. The engine is calibrated when the first serial
+// interface is constructed.
+class Timing
+{
+public:
+    // Construction and destruction
+    static Timing &instance();
+
+    // Waiting
+    uint64_t wait(uint64_t ns);
+
+    // Calibration results
+    bool tsc() const { return _tsc; }
+    double tsc_ghz() const { return _ticks_per_ns; }
+    uint64_t clock_cost() const { return _clock_cost; }
+    uint64_t sleep_margin() const { return _sleep_margin; }
+
+private:
+    // Construction and destruction
+    Timing();
+    Timing(const Timing &);
+    Timing &operator=(const Timing &);
+
+    // Calibration
+    void calibrate_tsc();
+    void calibrate_clock();
+    void calibrate_sleep();
+
+    // Auxiliary
+    uint64_t spin(uint64_t ns);
+
+    bool _tsc;
+    double _ticks_per_ns;
+    uint64_t _clock_cost;
+    uint64_t _sleep_margin;
+};
+
+#endif
@@ -0,0 +1,149 @@
+//
+// Configuration
+//
+
+// Header
+#include "waveform.hpp"
+
+// Local includes
+#include "linedriver.hpp"
+
+
+//
+// Construction and destruction
+//
+
+Waveform::Waveform() : _known(0), _lines(0), _written(0)
+{
+}
+
+
+//
+// Line transitions
+//
+
+/**
+ * Control the Data Terminal Ready line.
+ * @param value Status to set the line to.
+ */
+void Waveform::set_DTR(bool value)
+{
+    set_line(Line::DTR, value);
+}
+
+/**
+ * Control the Request To Send line.
+ * @param value Status to set the line to.
+ */
+void Waveform::set_RTS(bool value)
+{
+    set_line(Line::RTS, value);
+}
+
+/**
+ * Wait for the lines to settle. Consecutive delays collapse into one, as
+ * they only follow transitions which have been dropped.
+ */
+void Waveform::delay()
+{
+    if (!_steps.empty() && _steps.back().opcode == DELAY)
+        return;
+    Step step = {DELAY, 0, 0};
+    _steps.push_back(step);
+}
+
+/**
+ * Sample the Clear To Send line as a data bit.
+ */
+void Waveform::sample()
+{
+    Step step = {SAMPLE, 0, 0};
+    _steps.push_back(step);
+}
+
+/**
+ * Verify the Clear To Send line is set, aborting the waveform if not.
+ */
+void Waveform::ack()
+{
+    Step step = {ACK, 0, 0};
+    _steps.push_back(step);
+}
+
+
+/**
+ * Account for data bits clocked out by the preceding transitions.
+ * @param bits Amount of bits.
+ */
+void Waveform::count_written(unsigned int bits)
+{
+    _written += bits;
+}
+
+
+//
+// Composition
+//
+
+/**
+ * Append another waveform, eliminating the transitions which are redundant
+ * given the state this waveform leaves the lines in.
+ * @param other Waveform to append.
+ */
+void Waveform::append(const Waveform &other)
+{
+    _written += other._written;
+    for (auto step = other._steps.begin(); step != other._steps.end(); ++step) {
+        switch (step->opcode) {
+            case SET:
+                if (step->set)
+                    set_line(step->set, true);
+                if (step->clear)
+                    set_line(step->clear, false);
+                break;
+            case DELAY:
+                delay();
+                break;
+            default:
+                _steps.push_back(*step);
+        }
+    }
+}
+
+
+//
+// Inspection
+//
+
+/**
+ * Count the amount of line transitions in the waveform.
+ * @return Number of SET steps.
+ */
+size_t Waveform::transitions() const
+{
+    size_t count = 0;
+    for (auto step = _steps.begin(); step != _steps.end(); ++step)
+        if (step->opcode == SET)
+            count++;
+    return count;
+}
+
+
+//
+// Auxiliary
+//
+
+void Waveform::set_line(int line, bool value)
+{
+    if ((_known & line) && ((_lines & line) != 0) == value)
+        return;
+
+    _known |= line;
+    if (value)
+        _lines |= line;
+    else
+        _lines &= ~line;
+
+    Step step = {SET, value ? line : 0, value ? 0 : line};
+    _steps.push_back(step);
+}
@@ -0,0 +1,76 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_WAVEFORM_
+#define _OPENLACROSSE_WAVEFORM_
+
+// Standard library
+#include <cstddef>
+#include <vector>
+
+// Local includes
+#include "global.hpp"
+
+
+//
+// Module definitions
+//
+
+// A precompiled sequence of modem line transitions, delays and samples. Line
+// state is tracked while compiling, so transitions which wouldn't change the
+// line are never emitted.
+class Waveform
+{
+public:
+    // Subclasses
+    enum Opcode
+    {
+        SET,        // change output lines (clear, then set)
+        DELAY,      // wait for the lines to settle
+        SAMPLE,     // shift the inverted CTS line into the sample register
+        ACK         // abort the waveform unless CTS is set
+    };
+    struct Step
+    {
+        Opcode opcode;
+        int set;
+        int clear;
+    };
+
+    // Construction and destruction
+    Waveform();
+
+    // Line transitions
+    void set_DTR(bool value);
+    void set_RTS(bool value);
+    void delay();
+    void sample();
+    void ack();
+    void count_written(unsigned int bits);
+
+    // Composition
+    void append(const Waveform &other);
+
+    // Inspection
+    const std::vector<Step> &steps() const { return _steps; }
+    size_t transitions() const;
+    unsigned int bits_written() const { return _written; }
+
+private:
+    // Auxiliary
+    void set_line(int line, bool value);
+
+    // Compiled program
+    std::vector<Step> _steps;
+
+    // Line state at the end of the program
+    int _known;
+    int _lines;
+
+    // Amount of data bits clocked out by the program
+    unsigned int _written;
+};
+
+#endif
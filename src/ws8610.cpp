@@ -5,6 +5,11 @@
 // Header include
 #include "ws8610.hpp"
 
+// Standard library
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
 // Platform
 #include <unistd.h>
 #include <ctime>
@@ -14,21 +19,57 @@
 
 // Local includes
 #include "auxiliary.hpp"
+#include "civiltime.hpp"
+#include "mirror.hpp"
+#include "ws8610decoder.hpp"
 
 // Configurable values
-#define INIT_WAIT 500
+#define HANDSHAKE_TIMEOUT 5000 // ms to wait for each DSR edge
 #define MAX_READ_RETRIES 20
+#define MAX_REPAIR_ROUNDS 5 // re-reads of disagreeing bytes before falling
+                            // back to re-reading the entire range
+#define REPAIR_BLOCK_GAP 8  // disagreeing bytes closer than this are
+                            // re-read together
 #define HISTORY_START_LOCATION 0x0064
 #define HISTORY_END_LOCATION 0x7FFF
 #define MAGIC_LENGTH 64 // Windows tool uses 1024 characters,
                         // but this takes too long
+#define CHECKPOINT_INTERVAL 256
+#define CHECKPOINT_LENGTH 2
+#define HISTORY_INTERVAL 300
+#define HISTORY_CHUNK 256   // records read at once by history cursors
+#define TUNE_LENGTH 0x0D    // header bytes read to probe the bus timing
+#define TUNE_READS 16       // double reads of the header per edge delay
+#define TUNE_STEP 0.75      // factor the edge delay is tightened by
+#define TUNE_MIN_DELAY 50   // ns below which no delay is tried at all
+#define TUNE_MARGIN 2       // steps to back off from the fastest reliable
+                            // edge delay
 
 
 //
 // Construction and destruction
 //
 
-WS8610::WS8610(const std::string& portname) : Station(), _iface(portname)
+WS8610::WS8610(const std::string& portname) : Station(), _iface(portname),
+    _format(0), _external_sensors(0), _record_size(0), _max_records(0),
+    _checkpoint_interval(CHECKPOINT_INTERVAL), _validation(Validation::DOUBLE)
+{
+    connect();
+}
+
+WS8610::WS8610(LineDriver *driver) : Station(), _iface(driver),
+    _format(0), _external_sensors(0), _record_size(0), _max_records(0),
+    _checkpoint_interval(CHECKPOINT_INTERVAL), _validation(Validation::DOUBLE)
+{
+    connect();
+}
+
+
+//
+// Initialization
+//
+
+void WS8610::handshake()
 {
     clog(debug) << "Performing handshake" << std::endl;
 
@@ -41,63 +82,178 @@ WS8610::WS8610(const std::string& portname) : Station(), _iface(portname)
     _iface.set_RTS(false);
 
     clog(trace) << "Waiting for DSR" << std::endl;
-    int i = 0;
-    do {
-        usleep(10000);
-        i++;
-    } while (i < INIT_WAIT && !_iface.get_DSR());
-    if (i == INIT_WAIT)
+    uint64_t start = monotonic_ns();
+    if (!_iface.wait_DSR(true, HANDSHAKE_TIMEOUT))
         throw ProtocolException("Connection timeout (did not set DSR)");
+    uint64_t raised = monotonic_ns();
 
     clog(trace) << "Waiting for DSR getting cleared" << std::endl;
-    i = 0;
-    do {
-        usleep(10000);
-        i++;
-    } while (i < INIT_WAIT && _iface.get_DSR());
-    if (i != INIT_WAIT) {
-        _iface.set_RTS(true);
-        _iface.set_DTR(true);
-    } else {
+    if (!_iface.wait_DSR(false, HANDSHAKE_TIMEOUT))
         throw ProtocolException("Connection timeout (did not clear DSR)");
-    }
+    uint64_t cleared = monotonic_ns();
+    _iface.set_RTS(true);
+    _iface.set_DTR(true);
 
     clog(trace) << "Sending magic string" << std::endl;
     _iface.write_device(magic);
 
+    Statistics &stats = _iface.statistics();
+    stats.handshake_raise_ns += raised - start;
+    stats.handshake_clear_ns += cleared - raised;
+    clog(debug) << "Station raised DSR after " << (raised - start) / 1e6
+        << " ms, and cleared it after another " << (cleared - raised) / 1e6 << " ms" << std::endl;
+}
+
+void WS8610::probe()
+{
     clog(debug) << "Reading static properties" << std::endl;
 
     _external_sensors = external_sensors();
-    switch (_external_sensors) {
-        case 1:
-            _record_size = 10;
-            break;
-        case 2:
-            _record_size = 13;
-            break;
-        case 3:
-            _record_size = 15;
-            break;
-        default:
-            throw ProtocolException("Unsupported amount of external sensors");
+    try {
+        _format = &ws8610_format(_external_sensors);
     }
+    catch (std::invalid_argument const &) {
+        throw ProtocolException("Unsupported amount of external sensors");
+    }
+    _record_size = _format->record_size;
     _max_records = (HISTORY_END_LOCATION - HISTORY_START_LOCATION) / _record_size;
     clog(trace) << "Given " << _external_sensors << " external sensors, the record size is " << _record_size << " and the history is limited to " << _max_records << " records" << std::endl;
 }
 
+
+//
+// Session management
+//
+
+/**
+ * Open a new session with the station, and read its static properties.
+ * This also recovers a session which the station dropped, e.g. after it
+ * lost power or had its batteries replaced.
+ */
+void WS8610::connect()
+{
+    handshake();
+    _iface.statistics().handshakes++;
+    probe();
+}
+
+/**
+ * Check whether the session is still open, using a single unverified read
+ * of the external sensor count. A station which dropped the session does
+ * not acknowledge the address, and one which restarted can hold a
+ * different configuration, both of which require a new session.
+ * @return Whether the station still responds like it did when probed.
+ */
+bool WS8610::responsive()
+{
+    _iface.statistics().session_checks++;
+    _iface.start_sequence();
+    std::vector<byte> data = _iface.read_data(0x0C, 1);
+    bool alive = (data.size() == 1) && ((data[0] & 0x0F) == _external_sensors);
+    if (!alive) {
+        clog(warning) << "Station session dropped" << std::endl;
+        _iface.statistics().session_drops++;
+    }
+    return alive;
+}
+
+
 //
 // Station properties
 //
 
 unsigned int WS8610::external_sensors()
 {
-    std::vector<byte> data = read_safe(0x0C, 1);
+    std::vector<byte> data = memory(0x0C, 1);
     if (data.size() == 0)
         throw ProtocolException("Invalid external sensor count");
     return data[0] & 0x0F;
 }
 
 
+//
+// Configuration
+//
+
+/**
+ * Configure how often bulk reads verify the streamed data.
+ * @param interval Amount of bytes between checkpoints.
+ */
+void WS8610::set_checkpoint_interval(size_t interval)
+{
+    if (interval < CHECKPOINT_LENGTH)
+        throw std::invalid_argument("Checkpoint interval too small");
+    _checkpoint_interval = interval;
+}
+
+/**
+ * Configure how safe reads verify the data they received.
+ * @param mode Validation mode.
+ */
+void WS8610::set_validation(Validation::Mode mode)
+{
+    _validation = mode;
+}
+
+/**
+ * Configure how long the bus lines are given to settle after every edge.
+ * Slower stations or long cables may need more than the default.
+ * @param ns Delay in nanoseconds.
+ */
+void WS8610::set_edge_delay(unsigned int ns)
+{
+    _iface.set_edge_delay(ns);
+}
+
+/**
+ * Configure whether bus transactions run with real-time priority, which
+ * keeps the bit timing from being stretched by preemption.
+ * @param priority SCHED_FIFO priority, or 0 to leave the scheduling as is.
+ */
+void WS8610::set_realtime_priority(int priority)
+{
+    _iface.set_realtime_priority(priority);
+}
+
+/**
+ * Find the fastest bus timing the station reliably tolerates. Starting at
+ * the configured edge delay, the header is double read at progressively
+ * tighter delays until reads mismatch, after which the delay backs off a few
+ * steps from the fastest one without any mismatch, and is applied. When not
+ * even the initial delay is reliable, it is kept and tuning fails.
+ * @return Edge delay chosen, in nanoseconds.
+ */
+unsigned int WS8610::tune()
+{
+    const unsigned int initial = _iface.edge_delay();
+    std::vector<unsigned int> reliable;
+    for (double delay = initial;; delay *= TUNE_STEP) {
+        unsigned int ns = (delay < TUNE_MIN_DELAY) ? 0 : (unsigned int)delay;
+        _iface.set_edge_delay(ns);
+        double mismatches = header_mismatches(TUNE_READS);
+        clog(debug) << "Edge delay of " << ns << " ns: "
+            << mismatches * 100 << "% mismatches" << std::endl;
+        if (mismatches > 0)
+            break;
+        reliable.push_back(ns);
+        if (ns == 0)
+            break;
+    }
+
+    unsigned int chosen = reliable.empty() ? initial
+        : reliable[reliable.size() > TUNE_MARGIN ? reliable.size() - 1 - TUNE_MARGIN : 0];
+    _iface.set_edge_delay(chosen);
+
+    // Tighter timings may have confused the station
+    if (!responsive())
+        connect();
+
+    if (reliable.empty())
+        throw ProtocolException("Station is unreliable at the initial edge delay");
+    return chosen;
+}
+
+
 //
 // History management
 //
@@ -111,26 +267,34 @@ WS8610::HistoryRecord WS8610::history(unsigned int record_no)
     clog(trace) << "Reading record " << record_no << " from address 0x"
         << std::hex << (int)location << std::dec << std::endl;
 
-    std::vector<byte> record = read_safe(location, _record_size);
+    std::vector<byte> record = memory(location, _record_size);
     if (record.size() != _record_size)
         throw ProtocolException("Invalid history data received");
 
-    clog(trace) << "Record contents:" << std::hex;
-    for (size_t i = 0; i < _record_size; i++)
-        clog(trace) << " 0x" << (int)record[i];
-    clog(trace) << std::dec << std::endl;
-
-    time_t datetime = parse_datetime(record);
+    return decode_record(record);
+}
 
-    SensorRecord internal{parse_temperature(record, 0), parse_humidity(record, 0)};
-    std::vector<SensorRecord> external;
-    for (unsigned int s = 1; s <= _external_sensors; s++)
-        external.push_back(SensorRecord(parse_temperature(record, s), parse_humidity(record, s)));
+/**
+ * Read a range of consecutive history records, streaming them from the
+ * station instead of addressing every record separately.
+ * @param first Number of the first record.
+ * @param count Amount of records to read.
+ * @return      Records read.
+ */
+WS8610::HistoryBatch WS8610::history(unsigned int first, unsigned int count)
+{
+    std::vector<byte> data = read_records(first, count);
 
-    HistoryRecord hr{datetime, internal, external};
-    clog(trace) << "Parsed record contents: " << hr << std::endl;
+    HistoryBatch batch(_external_sensors, count);
+    RecordColumns columns = {batch.datetimes(), {0, 0, 0, 0}, {0, 0, 0, 0}};
+    for (unsigned int s = 0; s <= _external_sensors; s++) {
+        columns.temperature[s] = batch.temperatures(s);
+        columns.humidity[s] = batch.humidities(s);
+    }
+    if (count > 0)
+        _format->decode(data.data(), count, columns);
 
-    return hr;
+    return batch;
 }
 
 /// <summary>
@@ -139,41 +303,17 @@ WS8610::HistoryRecord WS8610::history(unsigned int record_no)
 /// <returns>Number of history records stored in memory</returns>
 int WS8610::history_count()
 {
-    auto data = read_safe(0x0009, 2);
-    return (data[0] >> 4) * 1000 + (data[1] & 0x0F) * 100
-        + (data[0] >> 4) * 10 + (data[0] & 0x0F);
-
-    // C#: (data[0] >> 4) * 1000 + (data[1] & 0x0F) * 100 + (data[0] >> 4) * 10 + (data[0] & 0x0F);
-    // C:  ((data[0] >> 4) * 10 + (data[0] & 0xF) +(data[1] >> 4) * 1000 + (data[1] & 0xF) * 100)
-
-    return ((data[0] >> 4) * 10 + (data[0] & 0xF) +(data[1] >> 4) * 1000 + (data[1] & 0xF) * 100);
+    auto data = memory(0x0009, 2);
+    return parse_count(data);
 }
 
 time_t WS8610::history_modtime()
 {
-    std::vector<byte> data = read_safe(0x0000, 6);
+    std::vector<byte> data = memory(0x0000, 6);
     if (data.size() != 6)
         throw ProtocolException("Invalid datetime data received");
 
-    time_t rawtime;
-    time(&rawtime);
-
-    struct tm *timeinfo;
-    timeinfo = localtime(&rawtime);
-
-    timeinfo->tm_isdst = -1;
-    timeinfo->tm_sec  = 0;
-    timeinfo->tm_min  = (data[0] >> 4) * 10 + (data[0] & 0xF);
-    timeinfo->tm_hour = (data[1] >> 4) * 10 + (data[1] & 0xF);
-    timeinfo->tm_mday = (data[2] >> 4) + (data[3] & 0xF) * 10;
-    timeinfo->tm_mon  = (data[3] >> 4) + (data[4] & 0xF) * 10 - 1;
-    timeinfo->tm_year = (data[4] >> 4) + (data[5] & 0xF) * 10 + 100;
-
-    rawtime = mktime(timeinfo);
-    if (rawtime == -1)
-    	throw new ProtocolException("Unparseable datetime data received");
-
-    return rawtime;
+    return parse_modtime(data);
 }
 
 WS8610::HistoryRecord WS8610::history_first()
@@ -183,27 +323,100 @@ WS8610::HistoryRecord WS8610::history_first()
 
 WS8610::HistoryRecord WS8610::history_last()
 {
-    auto first_rec = history(0);
-    time_t dt_last = history_modtime();
-    double difference = difftime(dt_last, first_rec.datetime);
-    int tot_records = 1 + int(difference / 300);
-    clog(trace) << "Total amount of records is " << tot_records << std::endl;
+    unsigned int frontier, oldest, count;
+    history_ring(frontier, oldest, count);
+    if (count == 0)
+        throw ProtocolException("History is empty");
+
+    unsigned int last = (frontier + _max_records - 1) % _max_records;
+    clog(debug) << "Last record is at " << last << std::endl;
+    return history(last);
+}
 
-    // Try to see if record (n+1) is valid
-    auto check = read_safe((address)(HISTORY_START_LOCATION + (tot_records * _record_size)), 1);
-    clog(trace) << "Next one starts with " << std::hex << (int)check[0] << std::dec;
-    if (check[0] != 0xFF)
-    {
-        clog(trace) << ", so skipping to it" << std::endl;
-        tot_records++;
-    }
-    else
-    {
-        clog(trace) << ", so sticking with current record" << std::endl;
+/**
+ * Read the records written after a point in time.
+ * @param datetime Point in time, or -1 to read the entire history.
+ * @return         Records, in chronological order.
+ */
+WS8610::HistoryBatch WS8610::history_since(time_t datetime)
+{
+    return history_range((datetime == -1) ? -1 : datetime + 1, -1);
+}
+
+/**
+ * Read the records written within a period of time. The boundaries are
+ * located once, after which the records in between are streamed, only
+ * splitting the transfer where the history wraps around.
+ * @param from Start of the period, or -1 to start at the oldest record.
+ * @param to   End of the period, inclusive, or -1 to end at the newest record.
+ * @return     Records, in chronological order.
+ */
+WS8610::HistoryBatch WS8610::history_range(time_t from, time_t to)
+{
+    unsigned int first, count;
+    history_bounds(from, to, first, count);
+    return history(first, count);
+}
+
+/**
+ * Prepare to read the records written within a period of time, a chunk of
+ * HISTORY_CHUNK records at a time.
+ * @param from Start of the period, or -1 to start at the oldest record.
+ * @param to   End of the period, inclusive, or -1 to end at the newest record.
+ * @return     Cursor over the records, in chronological order.
+ */
+WS8610::HistoryCursor WS8610::history_cursor(time_t from, time_t to)
+{
+    unsigned int first, count;
+    history_bounds(from, to, first, count);
+    return HistoryCursor(*this, first, count, HISTORY_CHUNK);
+}
+
+//
+// History layout
+//
+
+/**
+ * Locate the slot the next record will be written to, which holds the
+ * delimiter. Records are written from slot 0 onwards and wrap around, so
+ * slot 0 always holds the oldest record of the current lap: the slots before
+ * the frontier hold records at least as recent, while the delimiter, unused
+ * slots and the records of the previous lap after it are older or invalid.
+ * This allows a binary search, using O(log n) single record reads.
+ * @return Number of the slot.
+ */
+unsigned int WS8610::history_frontier()
+{
+    time_t origin = slot_datetime(0);
+    if (origin == -1)
+        return 0;
+
+    unsigned int low = 1, high = _max_records - 1;
+    while (low < high) {
+        unsigned int middle = low + (high - low) / 2;
+        time_t datetime = slot_datetime(middle);
+        if (datetime != -1 && datetime >= origin)
+            low = middle + 1;
+        else
+            high = middle;
     }
 
-    clog(debug) << "Last record is at " << tot_records - 1 << std::endl;
-    return history(tot_records - 1);
+    clog(debug) << "History frontier is at " << low << std::endl;
+    return low;
+}
+
+/**
+ * Locate the first record written at or after a point in time, using a
+ * binary search over the records in chronological order.
+ * @param datetime Point in time.
+ * @return         Number of the slot holding the record, or the frontier
+ *                 if there is no such record.
+ */
+unsigned int WS8610::history_find(time_t datetime)
+{
+    unsigned int frontier, oldest, count;
+    history_ring(frontier, oldest, count);
+    return (oldest + history_search(datetime, oldest, count)) % _max_records;
 }
 
 /// <summary>
@@ -212,39 +425,174 @@ WS8610::HistoryRecord WS8610::history_last()
 /// <returns>true if success</returns>
 bool WS8610::history_reset()
 {
+    drop_snapshot();
 	// C#: 0x00, 0x00
 	// C:  0x80, 0x02
     return _iface.write_data(0x0009, std::vector<byte>{0x00, 0x00});
 }
 
+/**
+ * Synchronize a persistent mirror of the station memory. Only the header and
+ * the records written since the previous synchronization are read, after
+ * which all queries are answered from the mirror as if it were a snapshot.
+ * @param mirror Mirror to synchronize.
+ */
+void WS8610::sync(Mirror &mirror)
+{
+    drop_snapshot();
+
+    std::vector<byte> header = read_safe(0x0000, HISTORY_START_LOCATION);
+    unsigned int count = parse_count(std::vector<byte>(header.begin() + 0x09, header.begin() + 0x0B));
+    bool looping = (header[0x0B] != 0x00);
+
+    bool incremental = mirror.valid
+        && mirror.metadata.record_size == _record_size
+        && mirror.metadata.frontier < _max_records;
+    if (incremental && !looping && count < mirror.metadata.record_count) {
+        clog(debug) << "History has been reset since the last sync" << std::endl;
+        incremental = false;
+    }
+
+    unsigned int frontier = mirror.metadata.frontier;
+    if (incremental && std::equal(header.begin(), header.end(), mirror.memory.begin())) {
+        clog(debug) << "Station memory unchanged since the last sync" << std::endl;
+    } else if (incremental) {
+        // A reset followed by enough new records hides in the count, but
+        // not in the first record, which is never overwritten before looping
+        if (!looping && mirror.metadata.record_count > 0) {
+            auto start = mirror.memory.begin() + HISTORY_START_LOCATION;
+            std::vector<byte> mirrored(start, start + _record_size);
+            if (parse_datetime(read_records(0, 1)) != parse_datetime(mirrored)) {
+                clog(debug) << "History has been reset since the last sync" << std::endl;
+                incremental = false;
+            }
+        }
+
+        // Estimate how many records have been written, including the
+        // delimiter following them
+        unsigned int estimate;
+        if (!looping) {
+            estimate = (count >= frontier) ? count - frontier + 1 : 1;
+        } else {
+            unsigned int previous = (frontier + _max_records - 1) % _max_records;
+            auto start = mirror.memory.begin() + HISTORY_START_LOCATION + previous * _record_size;
+            std::vector<byte> record(start, start + _record_size);
+            if (record[0] == 0xFF) {
+                estimate = 1;
+            } else {
+                double elapsed = difftime(parse_modtime(header), parse_datetime(record));
+                estimate = (elapsed > 0) ? (unsigned int)std::min<double>(
+                    elapsed / HISTORY_INTERVAL + 2, _max_records) : 2;
+            }
+        }
+
+        // Once about a lap has been written, slots beyond the new frontier
+        // no longer hold what the mirror does
+        if (incremental && estimate >= _max_records - 1) {
+            clog(debug) << "History has wrapped around since the last sync" << std::endl;
+            incremental = false;
+        }
+
+        // Read forward from the previous frontier until the delimiter is
+        // found, widening the range if the estimate was too low, but never
+        // over the whole ring
+        bool found = false;
+        unsigned int scanned = 0;
+        while (incremental && !found && scanned < _max_records - 1) {
+            unsigned int batch = std::min(estimate, _max_records - 1 - scanned);
+            clog(debug) << "Reading " << batch << " records from " << frontier << std::endl;
+            std::vector<byte> data = read_records(frontier, batch);
+
+            unsigned int next = (frontier + batch) % _max_records;
+            for (unsigned int i = 0; i < batch; i++) {
+                unsigned int slot = (frontier + i) % _max_records;
+                std::copy(data.begin() + i * _record_size, data.begin() + (i + 1) * _record_size,
+                    mirror.memory.begin() + HISTORY_START_LOCATION + slot * _record_size);
+                if (!found && data[i * _record_size] == 0xFF) {
+                    next = slot;
+                    found = true;
+                }
+            }
+            frontier = next;
+            scanned += batch;
+            estimate *= 2;
+        }
+        if (incremental && !found) {
+            clog(warning) << "History delimiter not found, resynchronizing" << std::endl;
+            incremental = false;
+        }
+        if (incremental && !looping && frontier != count % _max_records) {
+            clog(warning) << "History frontier does not match the record count, resynchronizing"
+                << std::endl;
+            incremental = false;
+        }
+    }
+
+    if (!incremental) {
+        clog(debug) << "Reading the entire history" << std::endl;
+        std::vector<byte> history = read_bulk(HISTORY_START_LOCATION,
+            HISTORY_END_LOCATION + 1 - HISTORY_START_LOCATION);
+        std::copy(history.begin(), history.end(), mirror.memory.begin() + HISTORY_START_LOCATION);
+
+        frontier = count % _max_records;
+        for (unsigned int slot = 0; slot < _max_records; slot++) {
+            if (history[slot * _record_size] == 0xFF) {
+                frontier = slot;
+                break;
+            }
+        }
+    }
+
+    std::copy(header.begin(), header.end(), mirror.memory.begin());
+    mirror.metadata.record_size = _record_size;
+    mirror.metadata.record_count = count;
+    mirror.metadata.loop_flags[0] = header[0x0B];
+    mirror.metadata.loop_flags[1] = header[0x0C];
+    std::copy(header.begin() + 0x51, header.begin() + 0x59, mirror.metadata.last_download);
+    mirror.metadata.frontier = frontier;
+    mirror.metadata.synced = time(0);
+    mirror.valid = true;
+    mirror.save();
+    clog(debug) << "Mirror synchronized, the next record will be written at " << frontier << std::endl;
+
+    _snapshot = mirror.memory;
+}
+
+
 //
 // Other
 //
 
 std::vector<byte> WS8610::memory_dump()
 {
-	// TODO: optimize this
-	std::vector<byte> memory(HISTORY_END_LOCATION, 0);
+    return memory(0x0000, HISTORY_END_LOCATION + 1, true);
+}
 
-	// Read the memory in 8-byte chunks
-	for (address i = 0; i < HISTORY_END_LOCATION; i += 8) {
-		size_t chunksize = 8;
-		if (i+chunksize > HISTORY_END_LOCATION)
-			chunksize = HISTORY_END_LOCATION - i;
+/**
+ * Take a verified snapshot of the entire memory. Until the snapshot is
+ * dropped, all queries are answered from it without accessing the bus.
+ */
+void WS8610::snapshot()
+{
+    drop_snapshot();
+
+    clog(debug) << "Taking memory snapshot" << std::endl;
+    std::vector<byte> snapshot = read_safe(0x0000, HISTORY_START_LOCATION);
+    std::vector<byte> history = read_bulk(HISTORY_START_LOCATION,
+        HISTORY_END_LOCATION + 1 - HISTORY_START_LOCATION);
+    snapshot.insert(snapshot.end(), history.begin(), history.end());
 
-		std::vector<byte> chunk = _iface.read_data(i, chunksize);
-		if (chunk.size() == 0) {
-			clog(warning) << "Could not dump memory at address 0x"
-					<< std::hex << i << std::endl;
-			continue;
-		}
+    _snapshot.swap(snapshot);
+}
 
-		assert(chunk.size() == chunksize);
-		for (unsigned int j = 0; j < chunksize; j++)
-			memory[i] = chunk[j];
-	}
+void WS8610::drop_snapshot()
+{
+    _snapshot.clear();
+}
 
-	return memory;
+const Statistics &WS8610::statistics()
+{
+    return _iface.statistics();
 }
 
 
@@ -252,34 +600,190 @@ std::vector<byte> WS8610::memory_dump()
 // Auxiliary
 //
 
-// TODO: move into SerialInterface
+// Timestamp of the record held in a slot, or -1 for the delimiter and
+// slots which do not hold a valid record
+time_t WS8610::slot_datetime(unsigned int slot)
+{
+    std::vector<byte> record = memory((address)(HISTORY_START_LOCATION + slot * _record_size), _record_size);
+    if (record[0] == 0xFF)
+        return -1;
+    try {
+        return parse_datetime(record);
+    }
+    catch (ProtocolException const &) {
+        return -1;
+    }
+}
+
+/**
+ * Determine which slots hold the history, in chronological order.
+ * @param frontier Slot the next record will be written to.
+ * @param oldest   Slot holding the oldest record.
+ * @param count    Amount of records.
+ */
+void WS8610::history_ring(unsigned int &frontier, unsigned int &oldest, unsigned int &count)
+{
+    frontier = history_frontier();
+    bool looping = (memory(0x000B, 1)[0] != 0x00);
+    oldest = looping ? (frontier + 1) % _max_records : 0;
+    count = looping ? _max_records - 1 : frontier;
+}
+
+/**
+ * Locate the records written within a period of time.
+ * @param from  Start of the period, or -1 to start at the oldest record.
+ * @param to    End of the period, inclusive, or -1 to end at the newest
+ *              record.
+ * @param first Number of the first record, which may exceed the amount of
+ *              slots when the range wraps around.
+ * @param count Amount of records.
+ */
+void WS8610::history_bounds(time_t from, time_t to, unsigned int &first, unsigned int &count)
+{
+    unsigned int frontier, oldest, stored;
+    history_ring(frontier, oldest, stored);
+
+    unsigned int begin = (from == -1) ? 0 : history_search(from, oldest, stored);
+    unsigned int end = (to == -1) ? stored : history_search(to + 1, oldest, stored);
+    end = std::max(begin, end);
+    clog(debug) << "Records " << begin << " to " << end << " of " << stored
+        << " lie within the requested period" << std::endl;
+
+    first = oldest + begin;
+    count = end - begin;
+}
+
+// Position within the chronological history of the first record written at
+// or after a point in time
+unsigned int WS8610::history_search(time_t datetime, unsigned int oldest, unsigned int count)
+{
+    unsigned int low = 0, high = count;
+    while (low < high) {
+        unsigned int middle = low + (high - low) / 2;
+        time_t current = slot_datetime((oldest + middle) % _max_records);
+        if (current != -1 && current < datetime)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+WS8610::HistoryRecord WS8610::decode_record(const std::vector<byte> &record)
+{
+    clog(trace) << "Record contents:" << std::hex;
+    for (size_t i = 0; i < _record_size; i++)
+        clog(trace) << " 0x" << (int)record[i];
+    clog(trace) << std::dec << std::endl;
+
+    time_t datetime = parse_datetime(record);
+
+    SensorRecord internal{parse_temperature(record, 0), parse_humidity(record, 0)};
+    std::vector<SensorRecord> external;
+    for (unsigned int s = 1; s <= _external_sensors; s++)
+        external.push_back(SensorRecord(parse_temperature(record, s), parse_humidity(record, s)));
+
+    HistoryRecord hr{datetime, internal, external};
+    clog(trace) << "Parsed record contents: " << hr << std::endl;
+
+    return hr;
+}
+
+/**
+ * Read the raw contents of consecutive history records, streaming them and
+ * only splitting the transfer where the history wraps around.
+ * @param first Number of the first record.
+ * @param count Amount of records to read.
+ * @return      Record contents.
+ */
+std::vector<byte> WS8610::read_records(unsigned int first, unsigned int count)
+{
+    std::vector<byte> data;
+    data.reserve(count * _record_size);
+
+    first %= _max_records;
+    while (count > 0) {
+        unsigned int chunk = std::min(count, _max_records - first);
+        address location = (address)(HISTORY_START_LOCATION + first * _record_size);
+        clog(trace) << "Reading " << chunk << " records starting at " << first
+            << " from address 0x" << std::hex << (int)location << std::dec << std::endl;
+
+        std::vector<byte> chunk_data = memory(location, chunk * _record_size, true);
+        data.insert(data.end(), chunk_data.begin(), chunk_data.end());
+
+        count -= chunk;
+        first = 0;
+    }
+
+    return data;
+}
+
+/**
+ * Read a range of memory, verifying the data received as configured.
+ * Semantic validation reads the range once, and only falls back to reading
+ * it twice if the data does not fit the memory layout.
+ * @param location Location to read from.
+ * @param length   Amount of bytes to read.
+ * @return         Data read.
+ */
 std::vector<byte> WS8610::read_safe(address location, size_t length)
+{
+    if (_validation == Validation::SEMANTIC) {
+        _iface.statistics().validations++;
+        _iface.start_sequence();
+        std::vector<byte> data = _iface.read_data(location, length);
+        bool zeroes = (length > 10)
+            && std::count(data.begin(), data.end(), 0) == (long)data.size();
+        if (data.size() == length && !zeroes && plausible(location, data))
+            return data;
+
+        clog(warning) << "Data read does not fit the memory layout" << std::endl;
+        _iface.statistics().validation_failures++;
+    }
+
+    return read_double(location, length);
+}
+
+// TODO: move into SerialInterface
+std::vector<byte> WS8610::read_double(address location, size_t length)
 {
     std::vector<byte> data, data2;
 
     unsigned int j;
     for (j = 0; j < MAX_READ_RETRIES; j++)
     {
+        if (j > 0)
+            _iface.statistics().read_retries++;
+
         _iface.start_sequence();
         data = _iface.read_data(location, length);
         _iface.start_sequence();
         data2 = _iface.read_data(location, length);
 
-        if (data.size() == 0 || data != data2)
+        if (data.size() != length || data2.size() != length)
         {
-            clog(warning) << "Reading twice resulted in different data" << std::endl;
+            clog(warning) << "Reading data failed" << std::endl;
+            _iface.statistics().read_mismatches++;
             continue;
         }
+        if (data != data2)
+        {
+            clog(warning) << "Reading twice resulted in different data" << std::endl;
+            _iface.statistics().read_mismatches++;
+            if (!repair(location, data, data2))
+                continue;
+        }
 
         // If we read more than 10 bytes we should never receive only 0's
         unsigned int i = 0;
         if (length > 10)
-            for (; data[i] == 0 && i < length; i++)
+            for (; i < length && data[i] == 0; i++)
             { }
 
         if (i != length)
             break;
         clog(warning) << "Reading data resulted in only 0's" << std::endl;
+        _iface.statistics().zero_rejections++;
     }
     
     if (j == MAX_READ_RETRIES)
@@ -288,36 +792,341 @@ std::vector<byte> WS8610::read_safe(address location, size_t length)
     return data;
 }
 
-std::vector<byte> WS8610::memory(address location, size_t length)
+/**
+ * Resolve the bytes on which two reads of a range disagree, by re-reading
+ * only the blocks containing them until every byte has a majority value.
+ * @param location Location the data was read from.
+ * @param data     Data of the first read, which receives the resolved bytes.
+ * @param other    Data of the second read.
+ * @return         Whether all bytes have been resolved.
+ */
+bool WS8610::repair(address location, std::vector<byte> &data, const std::vector<byte> &other)
+{
+    std::map<size_t, std::map<byte, unsigned int>> votes;
+    for (size_t i = 0; i < data.size(); i++) {
+        if (data[i] != other[i]) {
+            votes[i][data[i]]++;
+            votes[i][other[i]]++;
+        }
+    }
+
+    for (unsigned int round = 0; round < MAX_REPAIR_ROUNDS && !votes.empty(); round++) {
+        // Re-read the disputed bytes, merging nearby ones into a single block
+        auto block = votes.begin();
+        while (block != votes.end()) {
+            size_t begin = block->first, end = begin + 1;
+            auto next = block;
+            for (++next; next != votes.end() && next->first < end + REPAIR_BLOCK_GAP; ++next)
+                end = next->first + 1;
+
+            _iface.statistics().repair_reads++;
+            _iface.start_sequence();
+            std::vector<byte> reread = _iface.read_data((address)(location + begin), end - begin);
+            if (reread.size() == end - begin)
+                for (; block != next; ++block)
+                    block->second[reread[block->first - begin]]++;
+            block = next;
+        }
+
+        // Settle the bytes for which one value got the most votes
+        for (auto byte_votes = votes.begin(); byte_votes != votes.end(); ) {
+            byte value = 0;
+            unsigned int top = 0, second = 0;
+            for (auto vote = byte_votes->second.begin(); vote != byte_votes->second.end(); ++vote) {
+                if (vote->second > top) {
+                    second = top;
+                    top = vote->second;
+                    value = vote->first;
+                } else if (vote->second > second) {
+                    second = vote->second;
+                }
+            }
+
+            if (top >= 2 && top > second) {
+                data[byte_votes->first] = value;
+                _iface.statistics().repaired_bytes++;
+                byte_votes = votes.erase(byte_votes);
+            } else {
+                ++byte_votes;
+            }
+        }
+    }
+
+    if (!votes.empty())
+        clog(warning) << "Unable to resolve " << votes.size() << " bytes, re-reading everything" << std::endl;
+    return votes.empty();
+}
+
+static bool valid_bcd(byte value)
+{
+    return (value >> 4) <= 9 && (value & 0x0F) <= 9;
+}
+
+// Sensor values are either all BCD digits, or all 0xA when not available
+static bool valid_nibbles(const unsigned int *nibbles, size_t count)
+{
+    bool missing = true, digits = true;
+    for (size_t i = 0; i < count; i++) {
+        missing = missing && nibbles[i] == 0xA;
+        digits = digits && nibbles[i] <= 9;
+    }
+    return missing || digits;
+}
+
+static bool valid_sensor(const byte *record, unsigned int sensor)
+{
+    unsigned int temperature[3], humidity[2];
+    switch (sensor) {
+        case 0:
+            temperature[0] = record[6] & 0x0F; temperature[1] = record[5] >> 4; temperature[2] = record[5] & 0x0F;
+            humidity[0] = record[8] >> 4; humidity[1] = record[8] & 0x0F;
+            break;
+        case 1:
+            temperature[0] = record[7] >> 4; temperature[1] = record[7] & 0x0F; temperature[2] = record[6] >> 4;
+            humidity[0] = record[9] >> 4; humidity[1] = record[9] & 0x0F;
+            break;
+        case 2:
+            temperature[0] = record[11] & 0x0F; temperature[1] = record[10] >> 4; temperature[2] = record[10] & 0x0F;
+            humidity[0] = record[12] & 0x0F; humidity[1] = record[11] >> 4;
+            break;
+        case 3:
+            temperature[0] = record[13] >> 4; temperature[1] = record[13] & 0x0F; temperature[2] = record[12] >> 4;
+            humidity[0] = record[14] >> 4; humidity[1] = record[14] & 0x0F;
+            break;
+        default:
+            return false;
+    }
+    return valid_nibbles(temperature, 3) && valid_nibbles(humidity, 2);
+}
+
+// Wall-clock time of a record, as a number which increases along with it
+static unsigned long record_key(const byte *record)
+{
+    unsigned long key = 0;
+    for (int i = 4; i >= 0; i--)
+        key = key * 100 + (record[i] >> 4) * 10 + (record[i] & 0x0F);
+    return key;
+}
+
+/**
+ * Check whether data read fits the memory layout, as described in
+ * res/ws8610.dump. Only fields lying entirely within the range are checked:
+ * the header's modification time, record count and configuration, and for
+ * every history record its timestamp digits and ranges, the encoding of its
+ * sensor values, and that it is more recent than the record preceding it.
+ * @param location Location the data was read from.
+ * @param data     Data read.
+ * @return         Whether the data is plausible.
+ */
+bool WS8610::plausible(address location, const std::vector<byte> &data)
+{
+    size_t end = location + data.size();
+    auto at = [&](size_t offset) { return data[offset - location]; };
+
+    // Header
+    if (location <= 0x00 && end >= 0x06) {
+        unsigned int nibbles[12];
+        for (int i = 0; i < 6; i++) {
+            nibbles[2*i] = at(i) & 0x0F;
+            nibbles[2*i+1] = at(i) >> 4;
+        }
+        unsigned int minute = nibbles[1] * 10 + nibbles[0];
+        unsigned int hour = nibbles[3] * 10 + nibbles[2];
+        unsigned int mday = nibbles[6] * 10 + nibbles[5];
+        unsigned int month = nibbles[8] * 10 + nibbles[7];
+        if (!valid_bcd(at(0)) || !valid_bcd(at(1)) || minute > 59 || hour > 23
+            || nibbles[5] > 9 || nibbles[7] > 9 || nibbles[9] > 9 || nibbles[10] > 9
+            || mday < 1 || mday > 31 || month < 1 || month > 12)
+            return false;
+    }
+    if (location <= 0x09 && end >= 0x0B)
+        if (!valid_bcd(at(0x09)) || !valid_bcd(at(0x0A)))
+            return false;
+
+    // Configuration, which decides how everything else is decoded: the
+    // looping flag is only ever seen cleared or as 0x04, and the low nibble
+    // of the following byte holds the amount of external sensors
+    if (location <= 0x0B && end > 0x0B)
+        if (at(0x0B) != 0x00 && at(0x0B) != 0x04)
+            return false;
+    if (location <= 0x0C && end > 0x0C)
+        if ((at(0x0C) & 0x0F) < 1 || (at(0x0C) & 0x0F) > 3)
+            return false;
+
+    // History records, which can only be checked once the layout is known
+    if (_record_size == 0 || end <= HISTORY_START_LOCATION)
+        return true;
+    size_t start = std::max((size_t)location, (size_t)HISTORY_START_LOCATION);
+    size_t first = (start - HISTORY_START_LOCATION + _record_size - 1) / _record_size;
+    const byte *previous = 0;
+    for (size_t n = first; n < _max_records; n++) {
+        size_t offset = HISTORY_START_LOCATION + n * _record_size;
+        if (offset + _record_size > end)
+            break;
+        const byte *record = &data[offset - location];
+
+        // The delimiter following the most recent record
+        if (record[0] == 0xFF) {
+            previous = 0;
+            continue;
+        }
+
+        for (int i = 0; i < 5; i++)
+            if (!valid_bcd(record[i]))
+                return false;
+        unsigned int minute = (record[0] >> 4) * 10 + (record[0] & 0x0F);
+        unsigned int hour = (record[1] >> 4) * 10 + (record[1] & 0x0F);
+        unsigned int mday = (record[2] >> 4) * 10 + (record[2] & 0x0F);
+        unsigned int month = (record[3] >> 4) * 10 + (record[3] & 0x0F);
+        if (minute > 59 || hour > 23 || mday < 1 || mday > 31 || month < 1 || month > 12)
+            return false;
+
+        for (unsigned int s = 0; s <= _external_sensors; s++)
+            if (!valid_sensor(record, s))
+                return false;
+
+        if (previous && record_key(record) <= record_key(previous))
+            return false;
+        previous = record;
+    }
+
+    return true;
+}
+
+/**
+ * Measure how reliably the header can be read at the current bus timing,
+ * using the comparison of safe reads, and checking the data against the
+ * memory layout and the station configuration to catch consistent errors.
+ * @param reads Amount of double reads to perform.
+ * @return      Fraction of double reads which failed.
+ */
+double WS8610::header_mismatches(unsigned int reads)
+{
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < reads; i++) {
+        _iface.start_sequence();
+        std::vector<byte> data = _iface.read_data(0x0000, TUNE_LENGTH);
+        _iface.start_sequence();
+        std::vector<byte> data2 = _iface.read_data(0x0000, TUNE_LENGTH);
+
+        if (data.size() != TUNE_LENGTH || data != data2 || !plausible(0x0000, data)
+            || (data[0x0C] & 0x0F) != _external_sensors) {
+            _iface.statistics().tune_mismatches++;
+            mismatches++;
+        }
+    }
+    return (double)mismatches / reads;
+}
+
+/**
+ * Read a contiguous range of memory using a single addressing sequence.
+ * Instead of reading everything twice, the stream is verified at regular
+ * checkpoints by reading back the bytes preceding it, which also catches the
+ * address pointer slipping anywhere before. Segments failing verification
+ * are re-read safely.
+ * @param location Location to read from.
+ * @param length   Amount of bytes to read.
+ * @return         Data read.
+ */
+std::vector<byte> WS8610::read_bulk(address location, size_t length)
+{
+    _iface.start_sequence();
+    std::vector<byte> data = _iface.read_data(location, length);
+    bool streamed = (data.size() == length);
+    if (!streamed) {
+        clog(warning) << "Streaming data failed" << std::endl;
+        data.resize(length);
+    }
+
+    for (size_t segment = 0; segment < length; segment += _checkpoint_interval) {
+        size_t end = std::min(segment + _checkpoint_interval, length);
+
+        bool valid = false;
+        if (streamed) {
+            size_t span = std::min((size_t)CHECKPOINT_LENGTH, end - segment);
+            _iface.statistics().checkpoints++;
+            _iface.start_sequence();
+            std::vector<byte> check = _iface.read_data((address)(location + end - span), span);
+            valid = (check.size() == span)
+                && std::equal(check.begin(), check.end(), data.begin() + (end - span));
+            if (!valid) {
+                clog(warning) << "Checkpoint at address 0x" << std::hex
+                    << (int)(location + end) << std::dec << " failed" << std::endl;
+                _iface.statistics().checkpoint_mismatches++;
+            }
+        }
+
+        if (!valid) {
+            std::vector<byte> repaired = read_safe((address)(location + segment), end - segment);
+            std::copy(repaired.begin(), repaired.end(), data.begin() + segment);
+        }
+    }
+
+    return data;
+}
+
+/**
+ * Access a range of memory, from the snapshot if one has been taken.
+ * @param location Location to read from.
+ * @param length   Amount of bytes to read.
+ * @param bulk     Whether to stream the data instead of reading it twice.
+ * @return         Data read.
+ */
+std::vector<byte> WS8610::memory(address location, size_t length, bool bulk)
 {
-    address end_location = location + length - 1;
-    if (location < 0 || end_location > HISTORY_END_LOCATION)
+    size_t end_location = location + length - 1;
+    if (length == 0 || end_location > HISTORY_END_LOCATION)
     {
         //throw "Invalid address range: " + hex(address) + " - " + hex(end_addr));
         throw ProtocolException("Invalid address range");
     }
+
+    if (!_snapshot.empty())
+        return std::vector<byte>(_snapshot.begin() + location,
+            _snapshot.begin() + location + length);
+    if (bulk)
+        return read_bulk(location, length);
     return read_safe(location, length);
 }
 
-time_t WS8610::parse_datetime(const std::vector<byte> &data)
+
+//
+// Decoding
+//
+
+unsigned int WS8610::parse_count(const std::vector<byte> &data)
 {
-    time_t rawtime;
-    time(&rawtime);
+    // C#: (data[0] >> 4) * 1000 + (data[1] & 0x0F) * 100 + (data[0] >> 4) * 10 + (data[0] & 0x0F);
+    // C:  ((data[0] >> 4) * 10 + (data[0] & 0xF) +(data[1] >> 4) * 1000 + (data[1] & 0xF) * 100)
+    // The layout in res/ws8610.dump agrees with the C version.
+    return (data[0] >> 4) * 10 + (data[0] & 0xF)
+        + (data[1] >> 4) * 1000 + (data[1] & 0xF) * 100;
+}
 
-    struct tm *timeinfo;
-    timeinfo = localtime(&rawtime);
+time_t WS8610::parse_modtime(const std::vector<byte> &data)
+{
+    time_t rawtime = local_to_epoch(
+        (data[4] >> 4) + (data[5] & 0xF) * 10 + 2000,
+        (data[3] >> 4) + (data[4] & 0xF) * 10,
+        (data[2] >> 4) + (data[3] & 0xF) * 10,
+        (data[1] >> 4) * 10 + (data[1] & 0xF),
+        (data[0] >> 4) * 10 + (data[0] & 0xF));
+    if (rawtime == -1)
+        throw ProtocolException("Unparseable datetime data received");
 
-    timeinfo->tm_isdst = -1;
-    timeinfo->tm_sec  = 0;
-    timeinfo->tm_min  = (data[0] >> 4) * 10 + (data[0] & 0xF);
-    timeinfo->tm_hour = (data[1] >> 4) * 10 + (data[1] & 0xF);
-    timeinfo->tm_mday = (data[2] >> 4) * 10 + (data[2] & 0xF);
-    timeinfo->tm_mon  = (data[3] >> 4) * 10 + (data[3] & 0xF) - 1;
-    timeinfo->tm_year = (data[4] >> 4) * 10 + (data[4] & 0xF) + 100;
+    return rawtime;
+}
 
-    rawtime = mktime(timeinfo);
+time_t WS8610::parse_datetime(const std::vector<byte> &data)
+{
+    time_t rawtime = local_to_epoch(
+        (data[4] >> 4) * 10 + (data[4] & 0xF) + 2000,
+        (data[3] >> 4) * 10 + (data[3] & 0xF),
+        (data[2] >> 4) * 10 + (data[2] & 0xF),
+        (data[1] >> 4) * 10 + (data[1] & 0xF),
+        (data[0] >> 4) * 10 + (data[0] & 0xF));
     if (rawtime == -1)
-    	throw new ProtocolException("Unparseable datetime data received");
+        throw ProtocolException("Unparseable datetime data received");
 
     return rawtime;
 }
@@ -16,6 +16,7 @@
 #include "global.hpp"
 #include "station.hpp"
 #include "serialinterface.hpp"
+#include "recordlayout.hpp"
 
 // TODO: min/max, dewpoint
 
@@ -24,41 +25,104 @@
 // Module definitions
 //
 
+// How safe reads verify the data they received
+namespace Validation
+{
+    enum Mode
+    {
+        DOUBLE,     // read everything twice and compare
+        SEMANTIC    // read once and check against the memory layout
+    };
+}
+
 class WS8610 : public Station
 {
 public:
     // Construction and destruction
     WS8610(const std::string& portname);
+    WS8610(LineDriver *driver);
+
+    // Session management
+    void connect();
+    bool responsive();
 
     // Station properties
     unsigned int external_sensors();
 
+    // Configuration
+    void set_checkpoint_interval(size_t interval);
+    void set_validation(Validation::Mode mode);
+    void set_edge_delay(unsigned int ns);
+    void set_realtime_priority(int priority);
+    unsigned int tune();
+
     // History management
     HistoryRecord history(unsigned int record_no);
+    HistoryBatch history(unsigned int first, unsigned int count);
     int history_count();
     time_t history_modtime();
     HistoryRecord history_first();
     HistoryRecord history_last();
+    HistoryBatch history_since(time_t datetime);
+    HistoryBatch history_range(time_t from, time_t to);
+    HistoryCursor history_cursor(time_t from, time_t to);
+
+    // History layout
+    unsigned int history_frontier();
+    unsigned int history_find(time_t datetime);
     bool history_reset();
 
     // Other
     std::vector<byte> memory_dump();
+    void snapshot();
+    void drop_snapshot();
+    void sync(Mirror &mirror);
+    const Statistics &statistics();
 
-private:
-    // Auxiliary
-    std::vector<byte> read_safe(address location, size_t length);
-    std::vector<byte> memory(address location, size_t length);
+    // Decoding
+    static unsigned int parse_count(const std::vector<byte> &data);
+    static time_t parse_modtime(const std::vector<byte> &data);
     static time_t parse_datetime(const std::vector<byte> &data);
     static boost::optional<double> parse_temperature(const std::vector<byte> &data, int sensor);
     static boost::optional<unsigned int> parse_humidity(const std::vector<byte> &data, int sensor);
 
+private:
+    // Initialization
+    void handshake();
+    void probe();
+
+    // Auxiliary
+    time_t slot_datetime(unsigned int slot);
+    void history_ring(unsigned int &frontier, unsigned int &oldest, unsigned int &count);
+    void history_bounds(time_t from, time_t to, unsigned int &first, unsigned int &count);
+    unsigned int history_search(time_t datetime, unsigned int oldest, unsigned int count);
+    HistoryRecord decode_record(const std::vector<byte> &record);
+    std::vector<byte> read_records(unsigned int first, unsigned int count);
+    std::vector<byte> read_safe(address location, size_t length);
+    std::vector<byte> read_double(address location, size_t length);
+    bool repair(address location, std::vector<byte> &data, const std::vector<byte> &other);
+    bool plausible(address location, const std::vector<byte> &data);
+    double header_mismatches(unsigned int reads);
+    std::vector<byte> read_bulk(address location, size_t length);
+    std::vector<byte> memory(address location, size_t length, bool bulk = false);
+
     // Communication interface
     SerialInterface _iface;
 
     // Station characteristics
+    const RecordFormat *_format;
     unsigned int _external_sensors;
     unsigned int _record_size;
     unsigned int _max_records;
+
+    // Amount of bytes streamed between verifications of bulk reads
+    size_t _checkpoint_interval;
+
+    // Verification method of safe reads
+    Validation::Mode _validation;
+
+    // Memory snapshot, empty if none has been taken
+    std::vector<byte> _snapshot;
 };
 
 #endif
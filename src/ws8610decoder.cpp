@@ -0,0 +1,166 @@
+//
+// Configuration
+//
+
+// Header
+#include "ws8610decoder.hpp"
+
+// Standard library
+#include <stdexcept>
+
+// Local includes
+#include "civiltime.hpp"
+
+// Configurable values
+#define TEMPERATURE_OFFSET 300      // tenths of degrees the station adds
+#define TEMPERATURE_SENTINEL 1110   // raw value of 0xAAA, being 81.0 degrees
+#define HUMIDITY_SENTINEL 110       // raw value of 0xAA
+
+
+//
+// Lookup tables
+//
+
+// Decimal value of a byte holding two BCD digits, with the 0xA nibbles the
+// station stores for unavailable readings counting as ten
+#define DECIMAL(b) (uint8_t)(((b) >> 4) * 10 + ((b) & 0x0F))
+#define DECIMAL_ROW(r) \
+    DECIMAL(r + 0x0), DECIMAL(r + 0x1), DECIMAL(r + 0x2), DECIMAL(r + 0x3), \
+    DECIMAL(r + 0x4), DECIMAL(r + 0x5), DECIMAL(r + 0x6), DECIMAL(r + 0x7), \
+    DECIMAL(r + 0x8), DECIMAL(r + 0x9), DECIMAL(r + 0xA), DECIMAL(r + 0xB), \
+    DECIMAL(r + 0xC), DECIMAL(r + 0xD), DECIMAL(r + 0xE), DECIMAL(r + 0xF)
+
+static constexpr uint8_t DECIMALS[256] = {
+    DECIMAL_ROW(0x00), DECIMAL_ROW(0x10), DECIMAL_ROW(0x20), DECIMAL_ROW(0x30),
+    DECIMAL_ROW(0x40), DECIMAL_ROW(0x50), DECIMAL_ROW(0x60), DECIMAL_ROW(0x70),
+    DECIMAL_ROW(0x80), DECIMAL_ROW(0x90), DECIMAL_ROW(0xA0), DECIMAL_ROW(0xB0),
+    DECIMAL_ROW(0xC0), DECIMAL_ROW(0xD0), DECIMAL_ROW(0xE0), DECIMAL_ROW(0xF0)
+};
+
+#undef DECIMAL_ROW
+#undef DECIMAL
+
+
+//
+// Record layouts
+//
+
+// Field locations as described in res/ws8610.dump, in which the sensors
+// store their temperatures in two shapes: tens and units in one byte with
+// the hundreds in the low nibble of the next, or hundreds and tens in one
+// byte with the units in the high nibble of the previous
+template <size_t PAIR, size_t SINGLE, bool LEADING_PAIR>
+struct Temperature
+{
+    static int16_t decode(const byte *record)
+    {
+        int raw = LEADING_PAIR
+            ? DECIMALS[record[PAIR]] * 10 + (record[SINGLE] >> 4)
+            : DECIMALS[record[PAIR]] + (record[SINGLE] & 0x0F) * 100;
+        return (raw == TEMPERATURE_SENTINEL) ? TEMPERATURE_UNAVAILABLE
+            : (int16_t)(raw - TEMPERATURE_OFFSET);
+    }
+};
+
+// Humidities are a BCD byte, or two digits split over the low nibble of
+// one byte and the high nibble of the previous
+template <size_t LOCATION, bool SPLIT>
+struct Humidity
+{
+    static uint8_t decode(const byte *record)
+    {
+        uint8_t raw = SPLIT
+            ? DECIMALS[(byte)(record[LOCATION] << 4 | record[LOCATION - 1] >> 4)]
+            : DECIMALS[record[LOCATION]];
+        return (raw == HUMIDITY_SENTINEL) ? HUMIDITY_UNAVAILABLE : raw;
+    }
+};
+
+template <unsigned int SENSOR> struct WS8610Sensor;
+template <> struct WS8610Sensor<0>
+    : Temperature<5, 6, false>, Humidity<8, false> { };
+template <> struct WS8610Sensor<1>
+    : Temperature<7, 6, true>, Humidity<9, false> { };
+template <> struct WS8610Sensor<2>
+    : Temperature<10, 11, false>, Humidity<12, true> { };
+template <> struct WS8610Sensor<3>
+    : Temperature<13, 12, true>, Humidity<14, false> { };
+
+template <unsigned int EXTERNAL>
+struct WS8610Layout
+{
+    static const unsigned int EXTERNAL_SENSORS = EXTERNAL;
+    static const size_t RECORD_SIZE = (EXTERNAL == 1) ? 10 : (EXTERNAL == 2) ? 13 : 15;
+
+    template <unsigned int SENSOR>
+    struct Sensor
+    {
+        static int16_t temperature(const byte *record)
+            { return WS8610Sensor<SENSOR>::Temperature::decode(record); }
+        static uint8_t humidity(const byte *record)
+            { return WS8610Sensor<SENSOR>::Humidity::decode(record); }
+    };
+
+    static bool delimiter(const byte *record)
+    {
+        return record[0] == 0xFF;
+    }
+
+    static long hour_key(const byte *record)
+    {
+        return ((DECIMALS[record[4]] * 100L + DECIMALS[record[3]]) * 100
+            + DECIMALS[record[2]]) * 100 + DECIMALS[record[1]];
+    }
+
+    static time_t hour(const byte *record)
+    {
+        return local_to_epoch(DECIMALS[record[4]] + 2000, DECIMALS[record[3]],
+            DECIMALS[record[2]], DECIMALS[record[1]], 0);
+    }
+
+    static unsigned int minute(const byte *record)
+    {
+        return DECIMALS[record[0]];
+    }
+};
+
+static const RecordFormat FORMATS[] = {
+    record_format<WS8610Layout<1>>(),
+    record_format<WS8610Layout<2>>(),
+    record_format<WS8610Layout<3>>()
+};
+
+
+//
+// Batch decoding
+//
+
+/**
+ * Select the record format of a station.
+ * @param external_sensors Amount of external sensors (1 to 3).
+ * @return                 Record format.
+ */
+const RecordFormat &ws8610_format(unsigned int external_sensors)
+{
+    if (external_sensors < 1 || external_sensors > 3)
+        throw std::invalid_argument("Unsupported amount of external sensors");
+    return FORMATS[external_sensors - 1];
+}
+
+/**
+ * Decode a contiguous span of raw history records into columns, in a single
+ * pass per column. Sessions decoding many spans should select the format
+ * once using ws8610_format() instead.
+ * @param data             Raw records, laid out as described in
+ *                         res/ws8610.dump.
+ * @param count            Amount of records.
+ * @param external_sensors Amount of external sensors, which determines the
+ *                         record layout.
+ * @param columns          Columns to fill, holding at least count elements.
+ * @return                 Amount of records which are not the delimiter.
+ */
+size_t decode_records(const byte *data, size_t count, unsigned int external_sensors,
+    const RecordColumns &columns)
+{
+    return ws8610_format(external_sensors).decode(data, count, columns);
+}
@@ -0,0 +1,26 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_WS8610DECODER_
+#define _OPENLACROSSE_WS8610DECODER_
+
+// Standard library
+#include <cstddef>
+
+// Local includes
+#include "global.hpp"
+#include "recordlayout.hpp"
+
+
+//
+// Module definitions
+//
+
+const RecordFormat &ws8610_format(unsigned int external_sensors);
+
+size_t decode_records(const byte *data, size_t count, unsigned int external_sensors,
+    const RecordColumns &columns);
+
+#endif
@@ -0,0 +1,372 @@
+//
+// Configuration
+//
+
+// Header
+#include "ws8610emulator.hpp"
+
+// Standard library
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+// Configurable values
+#define HISTORY_START_LOCATION 0x0064
+#define HISTORY_END_LOCATION 0x7FFF
+#define HISTORY_INTERVAL 300
+
+
+//
+// Construction and destruction
+//
+
+WS8610Emulator::WS8610Emulator(const std::vector<byte> &memory)
+    : _memory(memory), _lines(0), _cts(false),
+      _handshake(HANDSHAKE_IDLE), _mode(MODE_IDLE), _pointer(0),
+      _shift(0), _bits(0), _ack_pending(false), _ack_clocked(false)
+{
+    _memory.resize(EMULATOR_MEMORY_SIZE, 0xFF);
+}
+
+
+//
+// Modem lines
+//
+
+/**
+ * Set the output modem lines, and react on the edges like the station would.
+ * @param lines Mask of output lines to raise, all others are cleared.
+ */
+void WS8610Emulator::set_lines(int lines)
+{
+    int changed = (_lines ^ lines) & Line::OUTPUTS;
+    _lines = lines & Line::OUTPUTS;
+
+    // RTS edges while the clock is low delimit a command
+    if ((changed & Line::RTS) && !(_lines & Line::DTR)) {
+        _cts = false;
+        _bits = 0;
+        _ack_pending = false;
+        _ack_clocked = false;
+        _mode = (_lines & Line::RTS) ? MODE_COMMAND : MODE_IDLE;
+    }
+
+    if (changed & Line::DTR) {
+        if (_lines & Line::DTR)
+            clock_rising();
+        else
+            clock_falling();
+    }
+}
+
+/**
+ * Get the status of the modem lines.
+ * @return Mask of lines which are raised.
+ */
+int WS8610Emulator::get_lines()
+{
+    int lines = _lines;
+    if (_cts)
+        lines |= Line::CTS;
+
+    // Once the magic string has been received and the host cleared its
+    // lines, raise DSR for a single poll, which is what the handshake waits
+    // for
+    if (_handshake == HANDSHAKE_MAGIC && _lines == 0) {
+        lines |= Line::DSR;
+        _handshake = HANDSHAKE_DSR;
+    }
+
+    return lines;
+}
+
+
+//
+// Byte stream
+//
+
+std::vector<byte> WS8610Emulator::read_device(size_t length)
+{
+    return std::vector<byte>(length, 0);
+}
+
+/**
+ * Receive bytes over the serial line. A session starts with a magic string,
+ * after which DSR is toggled, and ends the handshake with another one. A
+ * magic string received after that starts a new session.
+ * @param data Data received.
+ */
+void WS8610Emulator::write_device(const std::vector<byte> &data)
+{
+    if (data.empty() || data[0] != 'U')
+        return;
+
+    switch (_handshake) {
+        case HANDSHAKE_IDLE:
+        case HANDSHAKE_READY:
+            _handshake = HANDSHAKE_MAGIC;
+            break;
+        case HANDSHAKE_DSR:
+            _handshake = HANDSHAKE_READY;
+            break;
+        case HANDSHAKE_MAGIC:
+            break;
+    }
+}
+
+
+//
+// Protocol handling
+//
+
+void WS8610Emulator::clock_falling()
+{
+    // The clock following a received byte acknowledges the acknowledgement
+    if (_ack_pending) {
+        _ack_pending = false;
+        _ack_clocked = true;
+        return;
+    }
+
+    switch (_mode) {
+        case MODE_READ:
+            if (_lines & Line::RTS) {
+                // Advance to the next byte
+                _pointer = (address)((_pointer + 1) % EMULATOR_MEMORY_SIZE);
+                _bits = 0;
+            } else {
+                // Shift out the next bit, MSB first and inverted
+                byte value = _memory[_pointer];
+                bool bit = (value >> (7 - _bits)) & 1;
+                _cts = !bit;
+                _bits = (_bits + 1) % 8;
+            }
+            break;
+        case MODE_COMMAND:
+        case MODE_ADDRESS_HIGH:
+        case MODE_ADDRESS_LOW:
+        case MODE_WRITE:
+            // Shift in the next bit, MSB first and inverted
+            _shift = (byte)(_shift * 2 + ((_lines & Line::RTS) ? 0 : 1));
+            if (++_bits == 8) {
+                _bits = 0;
+                receive(_shift);
+            }
+            break;
+        case MODE_IDLE:
+            break;
+    }
+}
+
+void WS8610Emulator::clock_rising()
+{
+    if (_ack_clocked) {
+        _ack_clocked = false;
+        _cts = false;
+    }
+}
+
+void WS8610Emulator::receive(byte value)
+{
+    bool ack = true;
+    switch (_mode) {
+        case MODE_COMMAND:
+            if (value == 0xA0) {
+                _mode = MODE_ADDRESS_HIGH;
+            } else if (value == 0xA1) {
+                _mode = MODE_READ;
+            } else {
+                _mode = MODE_IDLE;
+                ack = false;
+            }
+            break;
+        case MODE_ADDRESS_HIGH:
+            _pointer = (address)(value << 8);
+            _mode = MODE_ADDRESS_LOW;
+            break;
+        case MODE_ADDRESS_LOW:
+            _pointer = (address)((_pointer | value) % EMULATOR_MEMORY_SIZE);
+            _mode = MODE_WRITE;
+            break;
+        case MODE_WRITE:
+            _memory[_pointer] = value;
+            _pointer = (address)((_pointer + 1) % EMULATOR_MEMORY_SIZE);
+            break;
+        default:
+            ack = false;
+    }
+
+    _cts = ack;
+    _ack_pending = ack;
+}
+
+
+//
+// Memory image
+//
+
+static byte bcd(unsigned int value)
+{
+    return (byte)(((value / 10) % 10) << 4 | (value % 10));
+}
+
+static void encode_temperature(byte *record, int sensor, int tenths)
+{
+    // Offset by 30 degrees, sensor values are stored as three BCD nibbles
+    unsigned int raw = (unsigned int)(tenths + 300);
+    unsigned int hi = (raw / 100) % 10, mid = (raw / 10) % 10, lo = raw % 10;
+    switch (sensor) {
+        case 0:
+            record[5] = (byte)(mid << 4 | lo);
+            record[6] = (byte)((record[6] & 0xF0) | hi);
+            break;
+        case 1:
+            record[7] = (byte)(hi << 4 | mid);
+            record[6] = (byte)((record[6] & 0x0F) | lo << 4);
+            break;
+        case 2:
+            record[10] = (byte)(mid << 4 | lo);
+            record[11] = (byte)((record[11] & 0xF0) | hi);
+            break;
+        case 3:
+            record[13] = (byte)(hi << 4 | mid);
+            record[12] = (byte)((record[12] & 0x0F) | lo << 4);
+            break;
+    }
+}
+
+static void encode_humidity(byte *record, int sensor, unsigned int humidity)
+{
+    switch (sensor) {
+        case 0:
+            record[8] = bcd(humidity);
+            break;
+        case 1:
+            record[9] = bcd(humidity);
+            break;
+        case 2:
+            record[11] = (byte)((record[11] & 0x0F) | (humidity % 10) << 4);
+            record[12] = (byte)((record[12] & 0xF0) | (humidity / 10) % 10);
+            break;
+        case 3:
+            record[14] = bcd(humidity);
+            break;
+    }
+}
+
+/**
+ * Generate a memory image laid out as described in res/ws8610.dump.
+ * @param external_sensors Amount of external sensors (1 to 3).
+ * @param records          Amount of records the station has written, the
+ *                         history loops if this exceeds its capacity.
+ * @param last             Timestamp of the last record.
+ * @return                 Memory image.
+ */
+std::vector<byte> WS8610Emulator::synthesize(unsigned int external_sensors,
+    unsigned int records, time_t last)
+{
+    unsigned int record_size;
+    switch (external_sensors) {
+        case 1:
+            record_size = 10;
+            break;
+        case 2:
+            record_size = 13;
+            break;
+        case 3:
+            record_size = 15;
+            break;
+        default:
+            throw std::invalid_argument("Unsupported amount of external sensors");
+    }
+    unsigned int max_records = (HISTORY_END_LOCATION - HISTORY_START_LOCATION) / record_size;
+    bool looping = records >= max_records;
+    unsigned int stored = looping ? max_records - 1 : records;
+
+    std::vector<byte> memory(EMULATOR_MEMORY_SIZE, 0x00);
+
+    // Last modification time
+    struct tm timeinfo;
+    localtime_r(&last, &timeinfo);
+    unsigned int year = timeinfo.tm_year % 100, month = timeinfo.tm_mon + 1;
+    memory[0x00] = bcd(timeinfo.tm_min);
+    memory[0x01] = bcd(timeinfo.tm_hour);
+    memory[0x02] = (byte)((timeinfo.tm_mday % 10) << 4 | timeinfo.tm_wday);
+    memory[0x03] = (byte)((month % 10) << 4 | timeinfo.tm_mday / 10);
+    memory[0x04] = (byte)((year % 10) << 4 | month / 10);
+    memory[0x05] = (byte)(year / 10);
+    memory[0x07] = 0xFF;
+    memory[0x08] = 0x01;
+
+    // History properties
+    memory[0x09] = bcd(stored % 100);
+    memory[0x0A] = bcd((stored / 100) % 100);
+    memory[0x0B] = looping ? 0x04 : 0x00;
+    memory[0x0C] = (byte)external_sensors;
+    memory[0x0D] = 0xFF;
+    memory[0x0E] = 0xFF;
+
+    // Alarm levels
+    const byte alarms[] = {
+        0x84, 0x13, 0x73, 0x09, 0x70, 0x10, 0x70, 0x10, 0x70, 0x10, 0x70,
+        0x10, 0x00, 0x12, 0x06, 0x10, 0x42, 0x00, 0x33, 0x06, 0x10, 0x41,
+        0x00, 0x00, 0x06, 0x00, 0x40, 0x00, 0x00, 0x06, 0x00, 0x40, 0x00,
+        0x00, 0x06, 0x00, 0x40, 0x00, 0x00, 0x06, 0x00, 0x40
+    };
+    std::copy(alarms, alarms + sizeof(alarms), memory.begin() + 0x21);
+
+    // Data recorder bookkeeping
+    const byte recorder[] = {
+        0x8E, 0xA2, 0x9A, 0x00, 0x00, 0x07, 0xAB, 0xAA, 0xAA, 0xAA, 0x1C,
+        0xE7, 0xE3, 0x40, 0x9A, 0x01, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+        0xFF, 0xFF, 0xFF
+    };
+    std::copy(recorder, recorder + sizeof(recorder), memory.begin() + 0x4B);
+
+    // History, with unwritten memory reading as 0xFF
+    std::fill(memory.begin() + HISTORY_START_LOCATION, memory.end(), 0xFF);
+    unsigned int first = records - stored;
+    for (unsigned int n = first; n < records; n++) {
+        byte *record = &memory[HISTORY_START_LOCATION + (n % max_records) * record_size];
+        std::fill(record, record + record_size, 0xAA);
+
+        time_t datetime = last - (time_t)(records - 1 - n) * HISTORY_INTERVAL;
+        localtime_r(&datetime, &timeinfo);
+        record[0] = bcd(timeinfo.tm_min);
+        record[1] = bcd(timeinfo.tm_hour);
+        record[2] = bcd(timeinfo.tm_mday);
+        record[3] = bcd(timeinfo.tm_mon + 1);
+        record[4] = bcd(timeinfo.tm_year % 100);
+
+        for (unsigned int s = 0; s <= external_sensors; s++) {
+            int phase = (int)((n * 7 + s * 13) % 41) - 20;
+            encode_temperature(record, s, (s == 0 ? 200 : 80) + phase);
+            encode_humidity(record, s, 50 + phase / 2);
+        }
+    }
+    memory[HISTORY_START_LOCATION + (records % max_records) * record_size] = 0xFF;
+
+    // Trailer
+    const byte trailer[] = { 0xFF, 0xFF, 0xFF, 0x5A, 0x3F, 0xFF, 0xFF, 0xFF };
+    std::copy(trailer, trailer + sizeof(trailer), memory.begin() + 0x7FF8);
+
+    return memory;
+}
+
+/**
+ * Load a memory image from a raw binary file.
+ * @param filename File to load.
+ * @return         Memory image.
+ */
+std::vector<byte> WS8610Emulator::load(const std::string &filename)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Unable to open memory image");
+    std::vector<byte> memory((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    if (memory.size() < HISTORY_END_LOCATION || memory.size() > EMULATOR_MEMORY_SIZE)
+        throw std::runtime_error("Invalid memory image size");
+    memory.resize(EMULATOR_MEMORY_SIZE, 0xFF);
+    return memory;
+}
@@ -0,0 +1,89 @@
+//
+// Configuration
+//
+
+// Include guard
+#ifndef _OPENLACROSSE_WS8610EMULATOR_
+#define _OPENLACROSSE_WS8610EMULATOR_
+
+// Standard library
+#include <string>
+#include <vector>
+#include <ctime>
+
+// Local includes
+#include "global.hpp"
+#include "linedriver.hpp"
+
+// Configurable values
+#define EMULATOR_MEMORY_SIZE 0x8000
+
+
+//
+// Module definitions
+//
+
+// In-process model of a WS8610, speaking the bit-banged bus protocol on the
+// modem lines and serving a memory image
+class WS8610Emulator : public LineDriver
+{
+public:
+    // Construction and destruction
+    WS8610Emulator(const std::vector<byte> &memory);
+
+    // Modem lines
+    void set_lines(int lines);
+    int get_lines();
+
+    // Byte stream
+    std::vector<byte> read_device(size_t length);
+    void write_device(const std::vector<byte> &data);
+
+    // Memory image
+    const std::vector<byte> &memory() const { return _memory; }
+    static std::vector<byte> synthesize(unsigned int external_sensors,
+        unsigned int records, time_t last);
+    static std::vector<byte> load(const std::string &filename);
+
+private:
+    // Subclasses
+    enum Handshake
+    {
+        HANDSHAKE_IDLE,
+        HANDSHAKE_MAGIC,
+        HANDSHAKE_DSR,
+        HANDSHAKE_READY
+    };
+    enum Mode
+    {
+        MODE_IDLE,
+        MODE_COMMAND,
+        MODE_ADDRESS_HIGH,
+        MODE_ADDRESS_LOW,
+        MODE_WRITE,
+        MODE_READ
+    };
+
+    // Protocol handling
+    void clock_falling();
+    void clock_rising();
+    void receive(byte value);
+
+    // Memory image
+    std::vector<byte> _memory;
+
+    // Line state
+    int _lines;
+    bool _cts;
+
+    // Protocol state
+    Handshake _handshake;
+    Mode _mode;
+    address _pointer;
+    byte _shift;
+    unsigned int _bits;
+    bool _ack_pending;
+    bool _ack_clocked;
+};
+
+#endif